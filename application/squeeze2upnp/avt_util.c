@@ -8,12 +8,14 @@
  */
 
 #include <stdlib.h>
+#include <stdarg.h>
 
 #include "platform.h"
 #include "ixmlextra.h"
 #include "upnptools.h"
 #include "cross_log.h"
 #include "avt_util.h"
+#include "mr_util.h"
 
 /*
 WARNING
@@ -23,7 +25,7 @@ WARNING
 extern log_level	upnp_loglevel;
 static log_level 	*loglevel = &upnp_loglevel;
 
-static char *CreateDIDL(char *URI, char *ProtInfo, struct metadata_s *MetaData, struct sMRConfig *Config);
+static char *CreateDIDL(struct sMR *Device, int Slot, char *URI, char *ProtoInfo, struct metadata_s *MetaData);
 
 /*----------------------------------------------------------------------------*/
 bool SubmitTransportAction(struct sMR *Device, IXML_Document *ActionNode) {
@@ -65,7 +67,7 @@ bool AVTSetURI(struct sMR *Device, char *URI, struct metadata_s *MetaData, char
 	IXML_Document *ActionNode = NULL;
 	struct sService *Service = &Device->Service[AVT_SRV_IDX];
 	
-	char *DIDLData = CreateDIDL(URI, ProtoInfo, MetaData, &Device->Config);
+	char *DIDLData = CreateDIDL(Device, 0, URI, ProtoInfo, MetaData);
 	LOG_INFO("[%p]: uPNP setURI %s (cookie %p)", Device, URI, Device->seqN);
 	LOG_DEBUG("[%p]: DIDL header: %s", Device, DIDLData);
 
@@ -73,7 +75,6 @@ bool AVTSetURI(struct sMR *Device, char *URI, struct metadata_s *MetaData, char
 	UpnpAddToAction(&ActionNode, "SetAVTransportURI", Service->Type, "InstanceID", "0");
 	UpnpAddToAction(&ActionNode, "SetAVTransportURI", Service->Type, "CurrentURI", URI);
 	UpnpAddToAction(&ActionNode, "SetAVTransportURI", Service->Type, "CurrentURIMetaData", DIDLData);
-	free(DIDLData);
 
 	return SubmitTransportAction(Device, ActionNode);
 }
@@ -83,7 +84,7 @@ bool AVTSetNextURI(struct sMR *Device, char *URI, struct metadata_s *MetaData, c
 	IXML_Document *ActionNode = NULL;
 	struct sService *Service = &Device->Service[AVT_SRV_IDX];
 
-	char *DIDLData = CreateDIDL(URI, ProtoInfo, MetaData, &Device->Config);
+	char *DIDLData = CreateDIDL(Device, 1, URI, ProtoInfo, MetaData);
 	LOG_INFO("[%p]: uPNP setNextURI %s (cookie %p)", Device, URI, Device->seqN);
 	LOG_DEBUG("[%p]: DIDL header: %s", Device, DIDLData);
 
@@ -91,7 +92,6 @@ bool AVTSetNextURI(struct sMR *Device, char *URI, struct metadata_s *MetaData, c
 	UpnpAddToAction(&ActionNode, "SetNextAVTransportURI", Service->Type, "InstanceID", "0");
 	UpnpAddToAction(&ActionNode, "SetNextAVTransportURI", Service->Type, "NextURI", URI);
 	UpnpAddToAction(&ActionNode, "SetNextAVTransportURI", Service->Type, "NextURIMetaData", DIDLData);
-	free(DIDLData);
 
 	return SubmitTransportAction(Device, ActionNode);
 }
@@ -300,94 +300,222 @@ int CtrlGetVolume(struct sMR *Device) {
 }
 
 /*----------------------------------------------------------------------------*/
-char *GetProtocolInfo(struct sMR *Device) {
-	IXML_Document *ActionNode, *Response = NULL;
-	struct sService *Service = &Device->Service[CNX_MGR_IDX];
+char *GetProtocolInfo(struct sService *Service, int TimeOut) {
+	IXML_Document *Response = NULL;
 	char *ProtocolInfo = NULL;
 
-	LOG_DEBUG("[%p]: uPNP GetProtocolInfo", Device);
-	ActionNode =  UpnpMakeAction("GetProtocolInfo", Service->Type, 0, NULL);
-
-	UpnpSendAction(glControlPointHandle, Service->ControlURL, Service->Type, NULL,
-							 ActionNode, &Response);
-
-	if (ActionNode) ixmlDocument_free(ActionNode);
+	LOG_DEBUG("uPNP GetProtocolInfo %s", Service->ControlURL);
+	SendAction(Service, "GetProtocolInfo", &Response, TimeOut);
 
 	if (Response) {
 		ProtocolInfo = XMLGetFirstDocumentItem(Response, "Sink", false);
 		ixmlDocument_free(Response);
-		LOG_DEBUG("[%p]: ProtocolInfo %s", Device, ProtocolInfo);
+		LOG_DEBUG("ProtocolInfo %s", ProtocolInfo);
 	}
 
 	return ProtocolInfo;
 }
 
 /*----------------------------------------------------------------------------*/
-char *CreateDIDL(char *URI, char *ProtoInfo, struct metadata_s *MetaData, struct sMRConfig *Config) {
-	IXML_Document *doc = ixmlDocument_createDocument();
-	IXML_Node	 *node, *root;
+static bool DIDLGrow(struct sDIDL *DIDL, size_t Len, size_t Needed) {
+	if (Len + Needed < DIDL->Size) return true;
 
-	root = XMLAddNode(doc, NULL, "DIDL-Lite", NULL);
-	XMLAddAttribute(doc, root, "xmlns:dc", "http://purl.org/dc/elements/1.1/");
-	XMLAddAttribute(doc, root, "xmlns:upnp", "urn:schemas-upnp-org:metadata-1-0/upnp/");
-	XMLAddAttribute(doc, root, "xmlns", "urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/");
-	XMLAddAttribute(doc, root, "xmlns:dlna", "urn:schemas-dlna-org:metadata-1-0/");
+	size_t Size = DIDL->Size ? DIDL->Size : 2048;
+	while (Size <= Len + Needed) Size *= 2;
 
-	node = XMLAddNode(doc, root, "item", NULL);
-	XMLAddAttribute(doc, node, "id", "1");
-	XMLAddAttribute(doc, node, "parentID", "0");
-	XMLAddAttribute(doc, node, "restricted", "1");
+	char *Data = realloc(DIDL->Data, Size);
+	if (!Data) {
+		DIDL->Failed = true;
+		return false;
+	}
 
-	if (MetaData->duration) {
-		div_t duration 	= div(MetaData->duration, 1000);
+	DIDL->Data = Data;
+	DIDL->Size = Size;
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static void DIDLPrintf(struct sDIDL *DIDL, size_t *Len, const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	int n = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if (n < 0 || !DIDLGrow(DIDL, *Len, n)) return;
+
+	va_start(args, fmt);
+	*Len += vsnprintf(DIDL->Data + *Len, DIDL->Size - *Len, fmt, args);
+	va_end(args);
+}
+
+/*----------------------------------------------------------------------------*/
+static void DIDLEscape(struct sDIDL *DIDL, size_t *Len, const char *s) {
+	if (!s) return;
+
+	// worst case is 6 bytes per character ("&quot;")
+	if (!DIDLGrow(DIDL, *Len, strlen(s) * 6)) return;
+
+	char *p = DIDL->Data + *Len;
+
+	for (; *s; s++) {
+		switch (*s) {
+		case '&': memcpy(p, "&amp;", 5); p += 5; break;
+		case '<': memcpy(p, "&lt;", 4); p += 4; break;
+		case '>': memcpy(p, "&gt;", 4); p += 4; break;
+		case '"': memcpy(p, "&quot;", 6); p += 6; break;
+		case '\'': memcpy(p, "&apos;", 6); p += 6; break;
+		default: *p++ = *s; break;
+		}
+	}
+
+	*p = '\0';
+	*Len = p - DIDL->Data;
+}
+
+/*----------------------------------------------------------------------------*/
+static void DIDLElement(struct sDIDL *DIDL, size_t *Len, char *Name, const char *Value) {
+	DIDLPrintf(DIDL, Len, "<%s>", Name);
+	DIDLEscape(DIDL, Len, Value);
+	DIDLPrintf(DIDL, Len, "</%s>", Name);
+}
+
+/*----------------------------------------------------------------------------*/
+static uint32_t DIDLHash(char *ProtoInfo, struct metadata_s *MetaData, struct sMRConfig *Config) {
+	uint32_t Hash = hash32(ProtoInfo);
+
+	Hash = Hash * 31 + hash32(MetaData->title);
+	Hash = Hash * 31 + hash32(MetaData->artist);
+	Hash = Hash * 31 + hash32(MetaData->album);
+	Hash = Hash * 31 + hash32(MetaData->genre);
+	Hash = Hash * 31 + hash32(MetaData->artwork);
+	Hash = Hash * 31 + hash32(MetaData->remote_title);
+	Hash = Hash * 31 + MetaData->duration;
+	Hash = Hash * 31 + (MetaData->track << 8 | MetaData->disc);
+	Hash = Hash * 31 + MetaData->sample_rate;
+	Hash = Hash * 31 + (MetaData->sample_size << 8 | MetaData->channels);
+
+	return Hash * 31 + Config->SendMetaData;
+}
+
+/*----------------------------------------------------------------------------*/
+static bool DIDLSameString(const char *a, const char *b) {
+	return a == b || (a && b && !strcmp(a, b));
+}
+
+/*----------------------------------------------------------------------------*/
+static bool DIDLMatch(struct sDIDL *DIDL, uint32_t Hash, char *URI, char *ProtoInfo, struct metadata_s *MetaData, bool SendMetaData) {
+	struct metadata_s *Cached = &DIDL->MetaData;
+
+	// hash only rules out, the key itself decides
+	return DIDL->Data && DIDL->URI && DIDL->Hash == Hash && !strcmp(DIDL->URI, URI) &&
+		   DIDLSameString(DIDL->ProtoInfo, ProtoInfo) && DIDL->SendMetaData == SendMetaData &&
+		   DIDLSameString(Cached->title, MetaData->title) && DIDLSameString(Cached->artist, MetaData->artist) &&
+		   DIDLSameString(Cached->album, MetaData->album) && DIDLSameString(Cached->genre, MetaData->genre) &&
+		   DIDLSameString(Cached->artwork, MetaData->artwork) && DIDLSameString(Cached->remote_title, MetaData->remote_title) &&
+		   Cached->duration == MetaData->duration && Cached->track == MetaData->track && Cached->disc == MetaData->disc &&
+		   Cached->sample_rate == MetaData->sample_rate && Cached->sample_size == MetaData->sample_size &&
+		   Cached->channels == MetaData->channels;
+}
+
+/*----------------------------------------------------------------------------*/
+static char *CreateDIDL(struct sMR *Device, int Slot, char *URI, char *ProtoInfo, struct metadata_s *MetaData) {
+	struct sMRConfig *Config = &Device->Config;
+	uint32_t Hash = DIDLHash(ProtoInfo, MetaData, Config);
+	struct sDIDL *DIDL = Device->DIDL + Slot;
+	size_t Len = 0;
+
+	// same track can be set again (flow, metadata update) or move from next to current
+	for (int i = 0; i < 2; i++) {
+		if (DIDLMatch(Device->DIDL + i, Hash, URI, ProtoInfo, MetaData, Config->SendMetaData)) {
+			LOG_DEBUG("[%p]: re-using DIDL (%d)", Device, i);
+			return Device->DIDL[i].Data;
+		}
+	}
 
+	// invalidate slot while it is rebuilt so that a failure can't be re-used
+	NFREE(DIDL->URI);
+	NFREE(DIDL->ProtoInfo);
+	DIDL->Hash = 0;
+	DIDL->Failed = false;
+
+	if (!DIDLGrow(DIDL, 0, 0)) return "";
+	DIDL->Data[0] = '\0';
+
+	DIDLPrintf(DIDL, &Len, "<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" "
+						   "xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" "
+						   "xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" "
+						   "xmlns:dlna=\"urn:schemas-dlna-org:metadata-1-0/\">"
+						   "<item id=\"1\" parentID=\"0\" restricted=\"1\">");
+
+	if (MetaData->duration) {
 		if (Config->SendMetaData) {
-			XMLAddNode(doc, node, "dc:title", MetaData->title);
-			XMLAddNode(doc, node, "dc:creator", MetaData->artist);
-			XMLAddNode(doc, node, "upnp:genre", MetaData->genre);
-			XMLAddNode(doc, node, "upnp:artist", MetaData->artist);
-			XMLAddNode(doc, node, "upnp:album", MetaData->album);
-			if (MetaData->track) XMLAddNode(doc, node, "upnp:originalTrackNumber", "%d", MetaData->track);
-			if (MetaData->disc) XMLAddNode(doc, node, "upnp:originalDiscNumber", "%d", MetaData->disc);
-			if (MetaData->artwork) XMLAddNode(doc, node, "upnp:albumArtURI", "%s", MetaData->artwork);
+			DIDLElement(DIDL, &Len, "dc:title", MetaData->title);
+			DIDLElement(DIDL, &Len, "dc:creator", MetaData->artist);
+			DIDLElement(DIDL, &Len, "upnp:genre", MetaData->genre);
+			DIDLElement(DIDL, &Len, "upnp:artist", MetaData->artist);
+			DIDLElement(DIDL, &Len, "upnp:album", MetaData->album);
+			if (MetaData->track) DIDLPrintf(DIDL, &Len, "<upnp:originalTrackNumber>%d</upnp:originalTrackNumber>", MetaData->track);
+			if (MetaData->disc) DIDLPrintf(DIDL, &Len, "<upnp:originalDiscNumber>%d</upnp:originalDiscNumber>", MetaData->disc);
+			if (MetaData->artwork) DIDLElement(DIDL, &Len, "upnp:albumArtURI", MetaData->artwork);
 		}
 
-		XMLAddNode(doc, node, "upnp:class", "object.item.audioItem.musicTrack");
-		node = XMLAddNode(doc, node, "res", URI);
-		XMLAddAttribute(doc, node, "duration", "%1d:%02d:%02d.%03d",
-						duration.quot/3600, (duration.quot % 3600) / 60,
-						duration.quot % 60, duration.rem);
+		DIDLPrintf(DIDL, &Len, "<upnp:class>object.item.audioItem.musicTrack</upnp:class>");
 	} else {
 		if (Config->SendMetaData) {
-			XMLAddNode(doc, node, "dc:title", MetaData->remote_title);
-			XMLAddNode(doc, node, "dc:creator", "");
-			XMLAddNode(doc, node, "upnp:album", "");
-			XMLAddNode(doc, node, "upnp:channelName", MetaData->remote_title);
-			XMLAddNode(doc, node, "upnp:channelNr", "%d", MetaData->track);
-			if (MetaData->artwork) XMLAddNode(doc, node, "upnp:albumArtURI", "%s", MetaData->artwork);
+			DIDLElement(DIDL, &Len, "dc:title", MetaData->remote_title);
+			DIDLElement(DIDL, &Len, "dc:creator", "");
+			DIDLElement(DIDL, &Len, "upnp:album", "");
+			DIDLElement(DIDL, &Len, "upnp:channelName", MetaData->remote_title);
+			DIDLPrintf(DIDL, &Len, "<upnp:channelNr>%d</upnp:channelNr>", MetaData->track);
+			if (MetaData->artwork) DIDLElement(DIDL, &Len, "upnp:albumArtURI", MetaData->artwork);
 		}
 
-		XMLAddNode(doc, node, "upnp:class", "object.item.audioItem.audioBroadcast");
-		node = XMLAddNode(doc, node, "res", URI);
+		DIDLPrintf(DIDL, &Len, "<upnp:class>object.item.audioItem.audioBroadcast</upnp:class>");
 	}
 
-	XMLAddAttribute(doc, node, "protocolInfo", ProtoInfo);
+	DIDLPrintf(DIDL, &Len, "<res");
+
+	if (MetaData->duration) {
+		div_t duration = div(MetaData->duration, 1000);
+		DIDLPrintf(DIDL, &Len, " duration=\"%1d:%02d:%02d.%03d\"",
+				   duration.quot/3600, (duration.quot % 3600) / 60,
+				   duration.quot % 60, duration.rem);
+	}
+
+	DIDLPrintf(DIDL, &Len, " protocolInfo=\"");
+	DIDLEscape(DIDL, &Len, ProtoInfo);
+	DIDLPrintf(DIDL, &Len, "\"");
 
 	// set optional parameters if we have them all (only happens with pcm)
 	if (MetaData->sample_rate && MetaData->sample_size && MetaData->channels) {
-		XMLAddAttribute(doc, node, "sampleFrequency", "%u", MetaData->sample_rate);
-		XMLAddAttribute(doc, node, "bitsPerSample", "%hhu", MetaData->sample_size);
-		XMLAddAttribute(doc, node, "nrAudioChannels", "%hhu", MetaData->channels);
+		DIDLPrintf(DIDL, &Len, " sampleFrequency=\"%u\" bitsPerSample=\"%hhu\" nrAudioChannels=\"%hhu\"",
+				   MetaData->sample_rate, MetaData->sample_size, MetaData->channels);
 		if (MetaData->duration)
-			XMLAddAttribute(doc, node, "size", "%u", (uint32_t) ((MetaData->sample_rate *
-							MetaData->sample_size / 8 * MetaData->channels *
-							(uint64_t) MetaData->duration) / 1000));
+			DIDLPrintf(DIDL, &Len, " size=\"%u\"", (uint32_t) ((MetaData->sample_rate *
+					   MetaData->sample_size / 8 * MetaData->channels *
+					   (uint64_t) MetaData->duration) / 1000));
+	}
+
+	DIDLPrintf(DIDL, &Len, ">");
+	DIDLEscape(DIDL, &Len, URI);
+	DIDLPrintf(DIDL, &Len, "</res></item></DIDL-Lite>");
+
+	// partial DIDL is useless, better send none
+	if (DIDL->Failed) {
+		LOG_ERROR("[%p]: can't allocate DIDL", Device);
+		DIDL->Data[0] = '\0';
+		return DIDL->Data;
 	}
 
-	char *s = ixmlNodetoString((IXML_Node*) doc);
-	ixmlDocument_free(doc);
+	// only a complete DIDL becomes a cache entry
+	DIDL->URI = strdup(URI);
+	DIDL->ProtoInfo = ProtoInfo ? strdup(ProtoInfo) : NULL;
+	metadata_clone(MetaData, &DIDL->MetaData);
+	DIDL->SendMetaData = Config->SendMetaData;
+	DIDL->Hash = Hash;
 
-	return s;
+	return DIDL->Data;
 }
 
 
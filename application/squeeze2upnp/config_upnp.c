@@ -12,6 +12,7 @@
 #include "squeeze2upnp.h"
 #include "ixmlextra.h"
 #include "config_upnp.h"
+#include "mr_util.h"
 #include "cross_log.h"
 
 extern log_level	slimproto_loglevel;
@@ -78,6 +79,7 @@ void SaveConfig(char *name, void *ref, bool full) {
 	XMLUpdateNode(doc, common, false, "roon_mode", "%d", (int) glDeviceParam.roon_mode);
 	XMLUpdateNode(doc, common, false, "force_aac", "%d", (int)glDeviceParam.force_aac);
 	XMLUpdateNode(doc, common, false, "cache", "%d", (int)glDeviceParam.cache);
+	XMLUpdateNode(doc, common, false, "pacing", "%d", (int)glDeviceParam.pacing);
 	XMLUpdateNode(doc, common, false, "forced_mimetypes", "%s", glMRConfig.ForcedMimeTypes);
 	XMLUpdateNode(doc, common, false, "seek_after_pause", "%d", (int) glMRConfig.SeekAfterPause);
 	XMLUpdateNode(doc, common, false, "live_pause", "%d", (int)glMRConfig.LivePause);
@@ -96,11 +98,11 @@ void SaveConfig(char *name, void *ref, bool full) {
 	XMLUpdateNode(doc, common, false, "resample_options", glDeviceParam.resample_options);
 #endif
 
-	for (int i = 0; i < MAX_RENDERERS; i++) {
+	for (int i = 0, Count = GetMRCount(); i < Count; i++) {
 		IXML_Node *dev_node;
 
-		if (!glMRDevices[i].Running) continue;
-		else p = &glMRDevices[i];
+		if (!glMRDevices[i]->Running) continue;
+		else p = glMRDevices[i];
 
 		// existing device, keep param and update "name" if LMS has requested it
 		if (old_doc && ((dev_node = (IXML_Node*) FindMRConfig(old_doc, p->UDN)) != NULL)) {
@@ -165,6 +167,7 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 	if (!strcmp(name, "roon_mode")) sq_conf->roon_mode = atol(val);
 	if (!strcmp(name, "force_aac")) sq_conf->force_aac = atol(val);
 	if (!strcmp(name, "cache")) sq_conf->cache = atol(val);
+	if (!strcmp(name, "pacing")) sq_conf->pacing = atol(val);
 	if (!strcmp(name, "raw_audio_format")) strcpy(sq_conf->raw_audio_format, val);
 	if (!strcmp(name, "store_prefix")) strcpy(sq_conf->store_prefix, val);			//RO
 	if (!strcmp(name, "sample_rate")) sq_conf->sample_rate = atol(val);
@@ -36,6 +36,6 @@ int 	CtrlSetVolume(struct sMR *Device, uint8_t Volume, void *Cookie);
 int 	CtrlSetMute(struct sMR *Device, bool Mute, void *Cookie);
 int 	CtrlGetVolume(struct sMR *Device);
 int 	CtrlGetGroupVolume(struct sMR *Device);
-char*	GetProtocolInfo(struct sMR *Device);
+char*	GetProtocolInfo(struct sService *Service, int TimeOut);
 
 
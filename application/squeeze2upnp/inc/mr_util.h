@@ -12,22 +12,30 @@
 #include "squeeze2upnp.h"
 
 void 		FlushMRDevices(void);
+void		FreeMRDevices(void);
+struct sMR *NewMRDevice(void);
+int			GetMRCount(void);
 void 		DelMRDevice(struct sMR *p);
-struct sMR *GetMaster(struct sMR *Device, char **Name);
+void		IndexMRDevice(struct sMR *Device);
+void		UnindexMRDevice(struct sMR *Device);
+struct sMR *GetMaster(struct sMR *Device, IXML_Document *Topology, char **Name);
 int 		CalcGroupVolume(struct sMR *Master);
 bool		CheckAndLock(struct sMR *Device);
 double		GetLocalGroupVolume(struct sMR *Member, int *count);
+int			DownloadDescDoc(const char *URL, IXML_Document **DescDoc, int TimeOut);
+int			SendAction(struct sService *Service, const char *Action, IXML_Document **Response, int TimeOut);
 
 struct sMR*  SID2Device(const UpnpString *SID);
 struct sMR*  CURL2Device(const UpnpString *CtrlURL);
 struct sMR*  PURL2Device(const UpnpString *URL);
 struct sMR*  UDN2Device(const char *SID);
+struct sMR*  DescURL2Device(const char *URL);
 
 struct sService* EventURL2Service(const UpnpString *URL, struct sService *s);
 
 int  XMLFindAndParseService(IXML_Document* DescDoc, const char* location, const char* serviceTypeBase, char** serviceType, 
                             char** serviceId, char** eventURL, char** controlURL, char** serviceURL);
-bool  XMLFindAction(const char* base, char* service, char* action);
+bool  XMLFindAction(IXML_Document* AVTDoc, char* action);
 char* XMLGetChangeItem(IXML_Document *doc, char *Tag, char *SearchAttr, char *SearchVal, char *RetAttr);
 
 char* uPNPEvent2String(Upnp_EventType S);
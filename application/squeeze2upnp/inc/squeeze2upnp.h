@@ -36,7 +36,7 @@
 /* typedefs */
 /*----------------------------------------------------------------------------*/
 
-#define MAX_RENDERERS	32
+#define MAX_RENDERERS	1024
 #define MAGIC			0xAABBCCDD
 #define RESOURCE_LENGTH	250
 
@@ -53,6 +53,16 @@ struct sService {
 	uint32_t		Failed;
 };
 
+struct sDIDL {
+	char			*Data;							// DIDL-Lite string, buffer is reused
+	size_t			Size;
+	bool			Failed;							// allocation failed while building Data
+	char			*URI, *ProtoInfo;				// cache key is URI, ProtoInfo and metadata
+	struct metadata_s MetaData;
+	bool			SendMetaData;
+	uint32_t		Hash;							// quick check before comparing key
+};
+
 typedef struct sMRConfig {
 	bool		SeekAfterPause;
 	bool		LivePause;
@@ -95,19 +105,20 @@ struct sMR {
 	void			*WaitCookie, *StartCookie;
 	cross_queue_t	ActionQueue;
 	unsigned		TrackPoll, StatePoll;
+	uint32_t		PollLast;						// last time timers have been updated
 	int				InfoExPoll;
 	int	 			SqueezeHandle;
 	struct sService Service[NB_SRV];
 	struct sAction	*Actions;
 	struct sMR		*Master;
 	pthread_mutex_t Mutex;
-	pthread_t 		Thread;
 	double			Volume;
 	bool			Muted;
 	uint32_t		VolumeStampRx, VolumeStampTx;	// timestamps to filter volume loopbacks
 	int				ErrorCount;                     // UPnP protocol error count, negative means fatal error
 	uint32_t		LastSeen;						// presence timeout for player which went dark
 	char			**MimeTypes;
+	struct sDIDL	DIDL[2];						// last DIDL for SetAVTransportURI and SetNext
 };
 
 extern UpnpClient_Handle   	glControlPointHandle;
@@ -116,7 +127,8 @@ extern char 				glBinding[];
 extern int32_t				glLogLimit;
 extern tMRConfig			glMRConfig;
 extern sq_dev_param_t		glDeviceParam;
-extern struct sMR			glMRDevices[MAX_RENDERERS];
+extern struct sMR			*glMRDevices[MAX_RENDERERS];
+extern int					glMRCount;
 extern pthread_mutex_t 		glMRMutex;
 
 int MasterHandler(Upnp_EventType EventType, const void* Event, void* Cookie);
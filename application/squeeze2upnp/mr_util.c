@@ -18,12 +18,29 @@
 #include "upnptools.h"
 #include "cross_thread.h"
 #include "cross_log.h"
+#include "cross_util.h"
 #include "mr_util.h"
 
 extern log_level	util_loglevel;
 static log_level 	*loglevel = &util_loglevel;
 
+#define MAX_DESC_SIZE	(256*1024)
+#define INDEX_SIZE		256
+
+enum { IDX_CURL, IDX_SID, IDX_UDN, IDX_DESC, NB_IDX };
+
+typedef struct sIndex {
+	uint32_t		Hash;
+	char			*Key;
+	struct sMR		*Device;
+	struct sIndex	*Next;
+} tIndex;
+
+static tIndex			*glIndex[NB_IDX][INDEX_SIZE];
+static pthread_rwlock_t	glIndexLock = PTHREAD_RWLOCK_INITIALIZER;
+
 static IXML_Node*	_getAttributeNode(IXML_Node *node, char *SearchAttr);
+static struct sMR*	FindMRDevice(int Idx, const char *Key);
 int 				_voidHandler(Upnp_EventType EventType, const void *_Event, void *Cookie) { return 0; }
 
 /*----------------------------------------------------------------------------*/
@@ -33,8 +50,8 @@ int CalcGroupVolume(struct sMR *Device) {
 
 	if (!*Device->Service[GRP_REND_SRV_IDX].ControlURL) return -1;
 
-	for (int i = 0; i < MAX_RENDERERS; i++) {
-		struct sMR *p = glMRDevices + i;
+	for (int i = 0, Count = GetMRCount(); i < Count; i++) {
+		struct sMR *p = glMRDevices[i];
 		if (p->Running && (p == Device || p->Master == Device)) {
 			if (p->Volume == -1) p->Volume = CtrlGetVolume(p);
 			GroupVolume += p->Volume;
@@ -46,24 +63,97 @@ int CalcGroupVolume(struct sMR *Device) {
 }
 
 /*----------------------------------------------------------------------------*/
-struct sMR *GetMaster(struct sMR *Device, char **Name) {
-	IXML_Document *Response;
-	struct sMR *Master = NULL;
-	struct sService *Service = &Device->Service[TOPOLOGY_IDX];
-	bool done = false;
+static int TimeLeft(uint32_t Deadline) {
+	// libupnp wants seconds, round up what's left of a deadline in ms
+	int32_t Left = Deadline - gettime_ms();
+	return Left > 0 ? (Left + 999) / 1000 : 0;
+}
 
-	if (!*Service->ControlURL) return NULL;
+/*----------------------------------------------------------------------------*/
+int SendAction(struct sService *Service, const char *Action, IXML_Document **Response, int TimeOut) {
+	void *Handle;
+	char *Request, *Header, *ContentType, *Buffer = NULL;
+	int ContentLength, HttpStatus, rc;
+	size_t Len = 0, Size = 0, Chunk;
+	UpnpString *Headers = UpnpString_new();
+	uint32_t Deadline = gettime_ms() + TimeOut * 1000;
+
+	*Response = NULL;
+
+	// same as UpnpSendAction (no argument) but a dead or slow host can't hold us for longer than TimeOut
+	(void)!asprintf(&Request, "<?xml version=\"1.0\"?>\r\n"
+					 "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+					 "<s:Body><u:%s xmlns:u=\"%s\"></u:%s></s:Body></s:Envelope>\r\n",
+					 Action, Service->Type, Action);
+	(void)!asprintf(&Header, "SOAPACTION: \"%s#%s\"\r\n", Service->Type, Action);
+	UpnpString_set_String(Headers, Header);
+	free(Header);
+
+	rc = UpnpOpenHttpConnection(Service->ControlURL, &Handle, TimeLeft(Deadline));
+	if (rc != UPNP_E_SUCCESS) {
+		UpnpString_delete(Headers);
+		free(Request);
+		return rc;
+	}
 
-	IXML_Document* ActionNode = UpnpMakeAction("GetZoneGroupState", Service->Type, 0, NULL);
+	rc = UpnpMakeHttpRequest(UPNP_HTTPMETHOD_POST, Service->ControlURL, Handle, Headers,
+							 "text/xml; charset=\"utf-8\"", strlen(Request), TimeLeft(Deadline));
+
+	if (rc == UPNP_E_SUCCESS) {
+		Chunk = strlen(Request);
+		rc = UpnpWriteHttpRequest(Handle, Request, &Chunk, TimeLeft(Deadline));
+	}
 
-	UpnpSendAction(glControlPointHandle, Service->ControlURL, Service->Type,
-								 NULL, ActionNode, &Response);
+	if (rc == UPNP_E_SUCCESS) rc = UpnpEndHttpRequest(Handle, TimeLeft(Deadline));
+	if (rc == UPNP_E_SUCCESS) rc = UpnpGetHttpResponse(Handle, NULL, &ContentType, &ContentLength, &HttpStatus, TimeLeft(Deadline));
+	if (rc == UPNP_E_SUCCESS && HttpStatus != 200) rc = UPNP_E_BAD_RESPONSE;
 
-	if (ActionNode) ixmlDocument_free(ActionNode);
+	UpnpString_delete(Headers);
+	free(Request);
 
-	char *Body = XMLGetFirstDocumentItem(Response, "ZoneGroupState", true);
-	if (Response) ixmlDocument_free(Response);
+	while (rc == UPNP_E_SUCCESS && Len < MAX_DESC_SIZE) {
+		Chunk = 4096;
 
+		if (!TimeLeft(Deadline)) {
+			rc = UPNP_E_TIMEDOUT;
+			break;
+		}
+
+		if (Len + Chunk + 1 > Size) {
+			char *p = realloc(Buffer, Size = Len + Chunk * 4 + 1);
+			if (!p) {
+				rc = UPNP_E_OUTOF_MEMORY;
+				break;
+			}
+			Buffer = p;
+		}
+
+		rc = UpnpReadHttpResponse(Handle, Buffer + Len, &Chunk, TimeLeft(Deadline));
+		Len += Chunk;
+		if (!Chunk) break;
+	}
+
+	UpnpCloseHttpConnection(Handle);
+
+	if (rc == UPNP_E_SUCCESS && Buffer) {
+		Buffer[Len] = '\0';
+		if ((*Response = ixmlParseBuffer(Buffer)) == NULL) rc = UPNP_E_BAD_RESPONSE;
+	}
+
+	NFREE(Buffer);
+	return rc;
+}
+
+/*----------------------------------------------------------------------------*/
+struct sMR *GetMaster(struct sMR *Device, IXML_Document *Topology, char **Name) {
+	IXML_Document *Response;
+	struct sMR *Master = NULL;
+	bool done = false;
+
+	// not a Sonos or it did not answer GetZoneGroupState
+	if (!Topology) return NULL;
+
+	char *Body = XMLGetFirstDocumentItem(Topology, "ZoneGroupState", true);
 	Response = ixmlParseBuffer(Body);
 	NFREE(Body);
 
@@ -93,10 +183,10 @@ struct sMR *GetMaster(struct sMR *Device, char **Name) {
 				done = !strcasecmp(myUUID, Coordinator);
 
 				// otherwise, look for our master (the coordinator) in existing devices
-				for (int k = 0; !done && k < MAX_RENDERERS; k++) {
-					if (!glMRDevices[k].Running || strcasestr(glMRDevices[k].UDN, (char*)Coordinator)) continue;
+				for (int k = 0, Count = GetMRCount(); !done && k < Count; k++) {
+					if (!glMRDevices[k]->Running || strcasestr(glMRDevices[k]->UDN, (char*)Coordinator)) continue;
 
-					Master = glMRDevices + k;
+					Master = glMRDevices[k];
 					LOG_DEBUG("Found Master %s %s", myUUID, Master->UDN);
 					done = true;
 				}
@@ -120,8 +210,8 @@ struct sMR *GetMaster(struct sMR *Device, char **Name) {
 
 /*----------------------------------------------------------------------------*/
 void FlushMRDevices(void) {
-	for (int i = 0; i < MAX_RENDERERS; i++) {
-		struct sMR *p = &glMRDevices[i];
+	for (int i = 0, Count = GetMRCount(); i < Count; i++) {
+		struct sMR *p = glMRDevices[i];
 		pthread_mutex_lock(&p->Mutex);
 		if (p->Running) {
 			// critical to stop the device otherwise libupnp might wait forever
@@ -137,6 +227,9 @@ void DelMRDevice(struct sMR *p) {
 	// already locked expect for failed creation which means a trylock is fine
 	pthread_mutex_trylock(&p->Mutex);
 
+	// no more reachable through callbacks
+	UnindexMRDevice(p);
+
 	// try to unsubscribe but missing players will not succeed and as a result
 	// terminating the libupnp takes a while ...
 	for (int i = 0; i < NB_SRV; i++) {
@@ -145,41 +238,36 @@ void DelMRDevice(struct sMR *p) {
 		}
 	}
 
+	// poll thread will not service it anymore
 	p->Running = false;
 
-	// kick-up all sleepers
-	crossthreads_wake();
+	AVTActionFlush(&p->ActionQueue);
+	metadata_free(&p->NextMetaData);
+	NFREE(p->NextProtoInfo);
+	NFREE(p->NextURI);
+	NFREE(p->ExpectedURI);
+	for (int i = 0; p->MimeTypes && p->MimeTypes[i]; i++) free(p->MimeTypes[i]);
+	NFREE(p->MimeTypes);
+	for (int i = 0; i < 2; i++) {
+		NFREE(p->DIDL[i].Data);
+		NFREE(p->DIDL[i].URI);
+		NFREE(p->DIDL[i].ProtoInfo);
+		metadata_free(&p->DIDL[i].MetaData);
+		p->DIDL[i].Size = 0;
+		p->DIDL[i].Hash = 0;
+	}
 
 	pthread_mutex_unlock(&p->Mutex);
-	pthread_join(p->Thread, NULL);
 }
 
 /*----------------------------------------------------------------------------*/
 struct sMR* CURL2Device(const UpnpString *CtrlURL) {
-	for (int i = 0; i < MAX_RENDERERS; i++) {
-		if (!glMRDevices[i].Running) continue;
-		for (int j = 0; j < NB_SRV; j++) {
-			if (!strcmp(glMRDevices[i].Service[j].ControlURL, UpnpString_get_String(CtrlURL))) {
-				return &glMRDevices[i];
-			}
-		}
-	}
-
-	return NULL;
+	return FindMRDevice(IDX_CURL, UpnpString_get_String(CtrlURL));
 }
 
 /*----------------------------------------------------------------------------*/
 struct sMR* SID2Device(const UpnpString *SID) {
-	for (int i = 0; i < MAX_RENDERERS; i++) {
-		if (!glMRDevices[i].Running) continue;
-		for (int j = 0; j < NB_SRV; j++) {
-			if (!strcmp(glMRDevices[i].Service[j].SID, UpnpString_get_String(SID))) {
-				return &glMRDevices[i];
-			}
-		}
-	}
-
-	return NULL;
+	return FindMRDevice(IDX_SID, UpnpString_get_String(SID));
 }
 
 /*----------------------------------------------------------------------------*/
@@ -193,11 +281,12 @@ struct sService *EventURL2Service(const UpnpString *URL, struct sService *s) {
 
 /*----------------------------------------------------------------------------*/
 struct sMR* UDN2Device(const char *UDN) {
-	for (int i = 0; i < MAX_RENDERERS; i++) {
-		if (glMRDevices[i].Running && !strcmp(glMRDevices[i].UDN, UDN)) return &glMRDevices[i];
-	}
+	return FindMRDevice(IDX_UDN, UDN);
+}
 
-	return NULL;
+/*----------------------------------------------------------------------------*/
+struct sMR* DescURL2Device(const char *URL) {
+	return FindMRDevice(IDX_DESC, URL);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -218,6 +307,185 @@ bool CheckAndLock(struct sMR *Device) {
 }
 
 
+/*----------------------------------------------------------------------------*/
+int DownloadDescDoc(const char *URL, IXML_Document **DescDoc, int TimeOut) {
+	void *Handle;
+	char *ContentType, *Buffer = NULL;
+	int ContentLength, HttpStatus, rc;
+	size_t Len = 0, Size = 0;
+	uint32_t Deadline = gettime_ms() + TimeOut * 1000;
+
+	*DescDoc = NULL;
+
+	// same as UpnpDownloadXmlDoc but a dead or slow host can't hold us for longer than TimeOut
+	rc = UpnpOpenHttpGet(URL, &Handle, &ContentType, &ContentLength, &HttpStatus, TimeLeft(Deadline));
+	if (rc != UPNP_E_SUCCESS) return rc;
+
+	if (HttpStatus != 200) {
+		UpnpCloseHttpGet(Handle);
+		return UPNP_E_INVALID_URL;
+	}
+
+	do {
+		size_t Chunk = 4096;
+
+		if (!TimeLeft(Deadline)) {
+			rc = UPNP_E_TIMEDOUT;
+			break;
+		}
+
+		if (Len + Chunk + 1 > Size) {
+			char *p = realloc(Buffer, Size = Len + Chunk * 4 + 1);
+			if (!p) {
+				rc = UPNP_E_OUTOF_MEMORY;
+				break;
+			}
+			Buffer = p;
+		}
+
+		rc = UpnpReadHttpGet(Handle, Buffer + Len, &Chunk, TimeLeft(Deadline));
+		Len += Chunk;
+		if (!Chunk) break;
+	} while (rc == UPNP_E_SUCCESS && Len < MAX_DESC_SIZE);
+
+	UpnpCloseHttpGet(Handle);
+
+	if (rc == UPNP_E_SUCCESS && Buffer) {
+		Buffer[Len] = '\0';
+		if ((*DescDoc = ixmlParseBuffer(Buffer)) == NULL) rc = UPNP_E_INVALID_DESC;
+	}
+
+	NFREE(Buffer);
+	return rc;
+}
+
+/*----------------------------------------------------------------------------*/
+/* 																			  */
+/* devices index															  */
+/* 																			  */
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+static void _IndexAdd(int Idx, char *Key, struct sMR *Device) {
+	if (!*Key) return;
+
+	tIndex *Item = malloc(sizeof(tIndex));
+	Item->Hash = hash32(Key);
+	Item->Key = strdup(Key);
+	Item->Device = Device;
+	Item->Next = glIndex[Idx][Item->Hash % INDEX_SIZE];
+	glIndex[Idx][Item->Hash % INDEX_SIZE] = Item;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _IndexRemove(struct sMR *Device) {
+	// only happens when adding/removing devices, so a full scan is fine
+	for (int i = 0; i < NB_IDX; i++) {
+		for (int j = 0; j < INDEX_SIZE; j++) {
+			for (tIndex **p = &glIndex[i][j]; *p;) {
+				tIndex *Item = *p;
+				if (Item->Device != Device) {
+					p = &Item->Next;
+					continue;
+				}
+				*p = Item->Next;
+				free(Item->Key);
+				free(Item);
+			}
+		}
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+void IndexMRDevice(struct sMR *Device) {
+	pthread_rwlock_wrlock(&glIndexLock);
+
+	_IndexRemove(Device);
+	_IndexAdd(IDX_UDN, Device->UDN, Device);
+	_IndexAdd(IDX_DESC, Device->DescDocURL, Device);
+	for (int i = 0; i < NB_SRV; i++) {
+		_IndexAdd(IDX_CURL, Device->Service[i].ControlURL, Device);
+		_IndexAdd(IDX_SID, Device->Service[i].SID, Device);
+	}
+
+	pthread_rwlock_unlock(&glIndexLock);
+}
+
+/*----------------------------------------------------------------------------*/
+void UnindexMRDevice(struct sMR *Device) {
+	pthread_rwlock_wrlock(&glIndexLock);
+	_IndexRemove(Device);
+	pthread_rwlock_unlock(&glIndexLock);
+}
+
+/*----------------------------------------------------------------------------*/
+static struct sMR *FindMRDevice(int Idx, const char *Key) {
+	struct sMR *Device = NULL;
+	uint32_t Hash = hash32((char*) Key);
+
+	pthread_rwlock_rdlock(&glIndexLock);
+
+	for (tIndex *Item = glIndex[Idx][Hash % INDEX_SIZE]; Item; Item = Item->Next) {
+		if (Item->Hash == Hash && !strcmp(Item->Key, Key)) {
+			Device = Item->Device;
+			break;
+		}
+	}
+
+	pthread_rwlock_unlock(&glIndexLock);
+
+	return Device;
+}
+
+/*----------------------------------------------------------------------------*/
+struct sMR *NewMRDevice(void) {
+	struct sMR *Device;
+	int i;
+
+	// only called by discovery, so there is a single writer
+	for (i = 0; i < glMRCount && glMRDevices[i]->Running; i++);
+	if (i < glMRCount) return glMRDevices[i];
+	if (i == MAX_RENDERERS) return NULL;
+
+	// device's mutex must exist for the lifetime of the application
+	Device = calloc(1, sizeof(struct sMR));
+	if (!Device) return NULL;
+	pthread_mutex_init(&Device->Mutex, 0);
+
+	// readers get the count under the same lock, so they always see the device
+	pthread_rwlock_wrlock(&glIndexLock);
+	glMRDevices[i] = Device;
+	glMRCount = i + 1;
+	pthread_rwlock_unlock(&glIndexLock);
+
+	return Device;
+}
+
+/*----------------------------------------------------------------------------*/
+int GetMRCount(void) {
+	int Count;
+
+	// slots below count are never NULL once published, so no need to check them
+	pthread_rwlock_rdlock(&glIndexLock);
+	Count = glMRCount;
+	pthread_rwlock_unlock(&glIndexLock);
+
+	return Count;
+}
+
+/*----------------------------------------------------------------------------*/
+void FreeMRDevices(void) {
+	pthread_rwlock_wrlock(&glIndexLock);
+
+	for (int i = 0; i < glMRCount; i++) {
+		pthread_mutex_destroy(&glMRDevices[i]->Mutex);
+		NFREE(glMRDevices[i]);
+	}
+
+	glMRCount = 0;
+	pthread_rwlock_unlock(&glIndexLock);
+}
+
 /*----------------------------------------------------------------------------*/
 /* 																			  */
 /* XML utils															  */
@@ -344,14 +612,10 @@ int XMLFindAndParseService(IXML_Document* DescDoc, const char* location,
 }
 
 /*----------------------------------------------------------------------------*/
-bool XMLFindAction(const char* base, char* service, char* action) {
-	char* url = malloc(strlen(base) + strlen(service) + 1 + 10);
-	IXML_Document* AVTDoc = NULL;
+bool XMLFindAction(IXML_Document* AVTDoc, char* action) {
 	bool res = false;
 
-	UpnpResolveURL(base, service, url);
-
-	if (UpnpDownloadXmlDoc(url, &AVTDoc) == UPNP_E_SUCCESS) {
+	if (AVTDoc) {
 		IXML_Element* actions = ixmlDocument_getElementById(AVTDoc, "actionList");
 		IXML_NodeList* actionList = ixmlDocument_getElementsByTagName((IXML_Document*)actions, "action");
 		int i;
@@ -370,9 +634,6 @@ bool XMLFindAction(const char* base, char* service, char* action) {
 		ixmlNodeList_free(actionList);
 	}
 
-	free(url);
-	ixmlDocument_free(AVTDoc);
-
 	return res;
 }
 
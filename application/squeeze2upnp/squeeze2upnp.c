@@ -76,6 +76,10 @@
 
 #define DISCOVERY_TIME 		30
 #define PRESENCE_TIMEOUT	(DISCOVERY_TIME * 6)
+#define FETCH_THREADS		4
+#define POLL_THREADS		4
+#define DESC_TIMEOUT		5
+#define DESC_MAX_AGE		600
 
 #define TRACK_POLL  	(1000)
 #define STATE_POLL  	(500)
@@ -94,7 +98,8 @@ enum { NEXT_FORCE = -1, NEXT_GAPPED = 0, NEXT_GAPLESS = 1 };
 /*----------------------------------------------------------------------------*/
 int32_t				glLogLimit = -1;
 char				glBinding[128] = "?";
-struct sMR			glMRDevices[MAX_RENDERERS];
+struct sMR			*glMRDevices[MAX_RENDERERS];
+int					glMRCount;
 pthread_mutex_t 	glMRMutex;
 UpnpClient_Handle 	glControlPointHandle;
 char				glCustomDiscovery[STR_LEN * 8];
@@ -145,6 +150,7 @@ sq_dev_param_t glDeviceParam = {
 					"aac,ogg,ops,ogf,flc,alc,wav,aif,pcm,mp3",		// codecs
 					"auto",					// mode
 					HTTP_CACHE_INFINITE,	// cache
+					0,						// pacing
 					true,					// mp4
 					30,						// next_delay
 					"raw,wav,aif",			// raw_audio_format
@@ -175,9 +181,36 @@ sq_dev_param_t glDeviceParam = {
 /*----------------------------------------------------------------------------*/
 /* local typedefs															  */
 /*----------------------------------------------------------------------------*/
+typedef struct sFetch {
+	enum { FETCH_DESC, FETCH_PRESENCE } Type;
+	char *Location, *UDN;
+	struct sMR *Device;						// when fetch is for an existing device
+	IXML_Document *DescDoc;
+	struct sService Service[NB_SRV];		// what we query on top of description
+	IXML_Document *Topology;				// Sonos GetZoneGroupState response
+	IXML_Document *AVTDoc;					// AVTransport actions, for a new device
+	char *ProtocolInfo;						// sink, for a new device
+	char *Name;
+	int rc;
+	cross_queue_t Deferred;					// updates for that device received while fetching
+	int nDeferred;
+	int MaxAge;
+	struct sFetch *Next;
+} tFetch;
+
+typedef struct sDesc {
+	char *Location;
+	uint32_t Expiry;
+	bool Valid;								// false when not a renderer or excluded
+	struct sDesc *Next;
+} tDesc;
+
 typedef struct sUpdate {
-	enum { DISCOVERY, BYE_BYE, SEARCH_TIMEOUT } Type;
+	enum { DISCOVERY, BYE_BYE, SEARCH_TIMEOUT, FETCHED } Type;
 	char *Data;
+	char *UDN;
+	int MaxAge;
+	tFetch *Fetch;
 } tUpdate;
 
 /*----------------------------------------------------------------------------*/
@@ -212,7 +245,14 @@ static pthread_mutex_t 	glUpdateMutex;
 
 static pthread_cond_t  	glUpdateCond;
 static pthread_t 		glMainThread, glUpdateThread;
+static pthread_t		glPollThreads[POLL_THREADS];
 static cross_queue_t	glUpdateQueue;
+static pthread_t		glFetchThreads[FETCH_THREADS];
+static pthread_mutex_t	glFetchMutex;
+static pthread_cond_t	glFetchCond;
+static cross_queue_t	glFetchQueue;
+static tFetch			*glFetching;
+static tDesc			*glDescCache;
 static char				*glLogFile;
 
 static char				*glPidFile = NULL;
@@ -321,9 +361,11 @@ static char license[] =
 /*----------------------------------------------------------------------------*/
 /* prototypes */
 /*----------------------------------------------------------------------------*/
-static void 	*MRThread(void *args);
+static void 	*PollThread(void *args);
 static 	void*	UpdateThread(void *args);
-static bool 	AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,	const char *location);
+static 	void*	FetchThread(void *args);
+static bool 	AddMRDevice(struct sMR *Device, char * UDN, tFetch *Fetch);
+static bool		isRenderer(IXML_Document *DescDoc);
 static bool		isExcluded(char *Model);
 static void 	NextTrack(struct sMR *Device);
 static void		DeltaOptions(char* ref, char* src);
@@ -463,14 +505,12 @@ bool sq_callback(void *caller, sq_action_t action, ...) {
 
 			// send volume to master + slaves
 			if (Device->Config.VolumeOnPlay == 1 && Device->Volume != -1) {
-				int i;
-
 				// don't want echo, even if sending onPlay
 				Device->VolumeStampTx = gettime_ms();
 
 				// update all devices (master & slaves) and set Master's volume if we don't have any
-				for (i = 0; i < MAX_RENDERERS; i++) {
-					struct sMR *p = glMRDevices + i;
+				for (int i = 0, Count = GetMRCount(); i < Count; i++) {
+					struct sMR *p = glMRDevices[i];
 					if (p->Running && (p->Master == Device || p == Device)) CtrlSetVolume(p, p->Volume != -1 ? p->Volume : Device->Volume, p->seqN++);
 				}
 			}
@@ -534,8 +574,8 @@ bool sq_callback(void *caller, sq_action_t action, ...) {
 				double Ratio = GroupVolume ? (double) Volume / GroupVolume : 0;
 
 				// for standalone master, GroupVolume equals Device->Volume
-				for (int i = 0; i < MAX_RENDERERS; i++) {
-					struct sMR *p = glMRDevices + i;
+				for (int i = 0, Count = GetMRCount(); i < Count; i++) {
+					struct sMR *p = glMRDevices[i];
 					if (!p->Running || (p != Device && p->Master != Device)) continue;
 
 					// must set a volume for slave if we have not acquired it already
@@ -571,79 +611,97 @@ bool sq_callback(void *caller, sq_action_t action, ...) {
 }
 
 /*----------------------------------------------------------------------------*/
-static void *MRThread(void *args) {
-	int elapsed, wakeTimer = MIN_POLL;
-	struct sMR *p = (struct sMR*) args;
-	unsigned last = gettime_ms();
-
-	for (; p->Running; crossthreads_sleep(wakeTimer)) {
-		elapsed = gettime_ms() - last;
-		pthread_mutex_lock(&p->Mutex);
-
-		p->StatePoll += elapsed;
-		p->TrackPoll += elapsed;
-		if (p->InfoExPoll != -1) p->InfoExPoll += elapsed;
-		wakeTimer = (p->sqState != SQ_STOP && p->on) ? MIN_POLL / 2 : MIN_POLL * 10;
-
-		LOG_SDEBUG("[%p]: UPnP thread timer %d %d", p, elapsed, wakeTimer);
-
-		// do nothing if we are a slave
-		if (p->Master) goto sleep;
-
-		// was just waiting for a short track to end
-		if (p->TrackWait > 0 && ((p->TrackWait -= elapsed) < 0)) {
-			LOG_WARN("[%p]: stopping on track wait timeout", p);
-			p->GapTrack = false;
-			sq_notify(p->SqueezeHandle, SQ_STOP, false);
-		}
+static int _PollMRDevice(struct sMR *p, int elapsed) {
+	int wakeTimer;
 
-		// hack to deal with players that do not report end of track
-		if (p->Duration < 0 && ((p->Duration += elapsed) >= 0)) {
-			if (p->NextURI) {
-				LOG_INFO("[%p] overtime next track", p);
-				NextTrack(p);
-			} else {
-				LOG_INFO("[%p] overtime last track", p);
-				p->Duration= 0;
-				AVTBasic(p, "Stop");
-			}
-		}
+	/*
+	ASSUMING DEVICE'S MUTEX LOCKED
+	*/
 
-		/* should not request any status update if we are stopped, off or waiting for an action
-		 * to be performed with an exception to poll extended informations if any for battery */
+	p->StatePoll += elapsed;
+	p->TrackPoll += elapsed;
+	if (p->InfoExPoll != -1) p->InfoExPoll += elapsed;
+	wakeTimer = (p->sqState != SQ_STOP && p->on) ? MIN_POLL / 2 : MIN_POLL * 10;
 
-		if (p->on && !p->WaitCookie && p->InfoExPoll >= INFOEX_POLL) {
-			p->InfoExPoll = 0;
-			AVTCallAction(p, "GetInfoEx", p->seqN++);
-		}
+	LOG_SDEBUG("[%p]: UPnP poll timer %d %d", p, elapsed, wakeTimer);
 
-		if (!p->on || (p->sqState == SQ_STOP && p->State == STOPPED) ||
-			 p->ErrorCount < 0 || p->ErrorCount > MAX_ACTION_ERRORS || p->WaitCookie) goto sleep;
-
-		// do polling as event is broken in many uPNP devices, but not synchronously
-		if (p->StatePoll >= STATE_POLL) {
-			// state polling (PLAY, STOP...)
-			p->StatePoll = 0;
-			AVTCallAction(p, "GetTransportInfo", p->seqN++);
-		} else if (p->TrackPoll >= TRACK_POLL) {
-			// get track position & CurrentURI
-			p->TrackPoll = 0;
-			if (p->sqState != SQ_STOP && p->sqState != SQ_PAUSE) AVTCallAction(p, "GetPositionInfo", p->seqN++);
+	// do nothing if we are a slave
+	if (p->Master) return wakeTimer;
+
+	// was just waiting for a short track to end
+	if (p->TrackWait > 0 && ((p->TrackWait -= elapsed) < 0)) {
+		LOG_WARN("[%p]: stopping on track wait timeout", p);
+		p->GapTrack = false;
+		sq_notify(p->SqueezeHandle, SQ_STOP, false);
+	}
+
+	// hack to deal with players that do not report end of track
+	if (p->Duration < 0 && ((p->Duration += elapsed) >= 0)) {
+		if (p->NextURI) {
+			LOG_INFO("[%p] overtime next track", p);
+			NextTrack(p);
+		} else {
+			LOG_INFO("[%p] overtime last track", p);
+			p->Duration= 0;
+			AVTBasic(p, "Stop");
 		}
+	}
 
-sleep:
-		pthread_mutex_unlock(&p->Mutex);
-		last = gettime_ms();
+	/* should not request any status update if we are stopped, off or waiting for an action
+	 * to be performed with an exception to poll extended informations if any for battery */
+
+	if (p->on && !p->WaitCookie && p->InfoExPoll >= INFOEX_POLL) {
+		p->InfoExPoll = 0;
+		AVTCallAction(p, "GetInfoEx", p->seqN++);
+	}
+
+	if (!p->on || (p->sqState == SQ_STOP && p->State == STOPPED) ||
+		 p->ErrorCount < 0 || p->ErrorCount > MAX_ACTION_ERRORS || p->WaitCookie) return wakeTimer;
+
+	// do polling as event is broken in many uPNP devices, but not synchronously
+	if (p->StatePoll >= STATE_POLL) {
+		// state polling (PLAY, STOP...)
+		p->StatePoll = 0;
+		AVTCallAction(p, "GetTransportInfo", p->seqN++);
+	} else if (p->TrackPoll >= TRACK_POLL) {
+		// get track position & CurrentURI
+		p->TrackPoll = 0;
+		if (p->sqState != SQ_STOP && p->sqState != SQ_PAUSE) AVTCallAction(p, "GetPositionInfo", p->seqN++);
 	}
 
+	return wakeTimer;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *PollThread(void *args) {
+	int Index = (int) (intptr_t) args;
+	int wakeTimer = MIN_POLL;
+
+	// a few threads share the timers of all renderers, so a slow one only delays its share
+	for (; glMainRunning; crossthreads_sleep(wakeTimer)) {
+		uint32_t now = gettime_ms();
+		wakeTimer = MIN_POLL * 10;
+
+		for (int i = Index, Count = GetMRCount(); i < Count; i += POLL_THREADS) {
+			struct sMR *p = glMRDevices[i];
+			if (!p->Running) continue;
+
+			// don't wait for a busy device, its timers will catch up on next pass
+			if (pthread_mutex_trylock(&p->Mutex)) {
+				wakeTimer = min(wakeTimer, MIN_POLL / 2);
+				continue;
+			}
+
+			if (p->Running) {
+				int elapsed = p->PollLast ? now - p->PollLast : 0;
+				p->PollLast = now;
+				wakeTimer = min(wakeTimer, _PollMRDevice(p, elapsed));
+			}
+
+			pthread_mutex_unlock(&p->Mutex);
+		}
+	}
 
-	AVTActionFlush(&p->ActionQueue);
-	metadata_free(&p->NextMetaData);
-	NFREE(p->NextProtoInfo);
-	NFREE(p->NextURI);
-	NFREE(p->ExpectedURI);
-	for (int i = 0; p->MimeTypes && p->MimeTypes[i]; i++) free(p->MimeTypes[i]);
-	NFREE(p->MimeTypes);
 	return NULL;
 }
 
@@ -1000,6 +1058,9 @@ int MasterHandler(Upnp_EventType EventType, const void *_Event, void *Cookie) {
 
 		Update->Type = DISCOVERY;
 		Update->Data = strdup(UpnpString_get_String(UpnpDiscovery_get_Location(_Event)));
+		Update->UDN = strdup(UpnpString_get_String(UpnpDiscovery_get_DeviceID(_Event)));
+		Update->MaxAge = UpnpDiscovery_get_Expires(_Event);
+		Update->Fetch = NULL;
 		LOG_DEBUG("received UPnP discover response %s", Update->Data);
 		queue_insert(&glUpdateQueue, Update);
 		pthread_cond_signal(&glUpdateCond);
@@ -1011,6 +1072,9 @@ int MasterHandler(Upnp_EventType EventType, const void *_Event, void *Cookie) {
 
 		Update->Type = BYE_BYE;
 		Update->Data = strdup(UpnpString_get_String(UpnpDiscovery_get_DeviceID(_Event)));
+		Update->UDN = NULL;
+		Update->MaxAge = 0;
+		Update->Fetch = NULL;
 		queue_insert(&glUpdateQueue, Update);
 		pthread_cond_signal(&glUpdateCond);
 
@@ -1020,7 +1084,9 @@ int MasterHandler(Upnp_EventType EventType, const void *_Event, void *Cookie) {
 		tUpdate* Update = malloc(sizeof(tUpdate));
 
 		Update->Type = SEARCH_TIMEOUT;
-		Update->Data = NULL;
+		Update->Data = Update->UDN = NULL;
+		Update->MaxAge = 0;
+		Update->Fetch = NULL;
 		queue_insert(&glUpdateQueue, Update);
 		pthread_cond_signal(&glUpdateCond);
 
@@ -1072,6 +1138,7 @@ int MasterHandler(Upnp_EventType EventType, const void *_Event, void *Cookie) {
 				s->Failed = 0;
 				strcpy(s->SID, UpnpString_get_String(UpnpEventSubscribe_get_SID(_Event)));
 				s->TimeOut = UpnpEventSubscribe_get_TimeOut(_Event);
+				IndexMRDevice(Device);
 				LOG_INFO("[%p]: subscribe success", Device);
 			} else if (s->Failed++ < 3) {
 				LOG_INFO("[%p]: subscribe fail, re-trying %u", Device, s->Failed);
@@ -1097,184 +1164,465 @@ int MasterHandler(Upnp_EventType EventType, const void *_Event, void *Cookie) {
 	return 0;
 }
 
+/*----------------------------------------------------------------------------*/
+static void FreeUpdate(void *_Item);
+
+/*----------------------------------------------------------------------------*/
+static void FreeFetch(void *_Item) {
+	tFetch *Fetch = (tFetch*) _Item;
+	queue_flush(&Fetch->Deferred);
+	if (Fetch->DescDoc) ixmlDocument_free(Fetch->DescDoc);
+	if (Fetch->Topology) ixmlDocument_free(Fetch->Topology);
+	if (Fetch->AVTDoc) ixmlDocument_free(Fetch->AVTDoc);
+	NFREE(Fetch->ProtocolInfo);
+	NFREE(Fetch->Name);
+	NFREE(Fetch->Location);
+	NFREE(Fetch->UDN);
+	free(Fetch);
+}
+
 /*----------------------------------------------------------------------------*/
 static void FreeUpdate(void *_Item) {
 	tUpdate *Item = (tUpdate*) _Item;
+	if (Item->Fetch) FreeFetch(Item->Fetch);
 	NFREE(Item->Data);
+	NFREE(Item->UDN);
 	free(Item);
 }
 
 /*----------------------------------------------------------------------------*/
-static void *UpdateThread(void *args) {
+static tFetch *Fetching(const char *Location, const char *UDN) {
+	// only UpdateThread uses that list, no need to lock
+	for (tFetch *Fetch = glFetching; Fetch; Fetch = Fetch->Next) {
+		if ((Location && !strcmp(Fetch->Location, Location)) ||
+			(UDN && Fetch->UDN && !strcmp(Fetch->UDN, UDN))) return Fetch;
+	}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static tDesc *DescLookup(char *Location) {
+	uint32_t now = gettime_ms() / 1000;
+
+	// only UpdateThread uses that cache, no need to lock
+	for (tDesc **p = &glDescCache; *p; ) {
+		tDesc *Desc = *p;
+
+		// drop all expired entries, not only the one we look for
+		if ((int32_t) (Desc->Expiry - now) <= 0) {
+			*p = Desc->Next;
+			free(Desc->Location);
+			free(Desc);
+			continue;
+		}
+
+		if (!strcmp(Desc->Location, Location)) return Desc;
+		p = &Desc->Next;
+	}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void DescUpdate(char *Location, int MaxAge, bool Valid) {
+	tDesc *Desc = DescLookup(Location);
+
+	if (!Desc) {
+		Desc = calloc(1, sizeof(tDesc));
+		Desc->Location = strdup(Location);
+		Desc->Next = glDescCache;
+		glDescCache = Desc;
+	}
+
+	// what SSDP says, but we still want to catch renaming at some point
+	if (MaxAge <= 0 || MaxAge > DESC_MAX_AGE) MaxAge = DESC_MAX_AGE;
+	Desc->Expiry = gettime_ms() / 1000 + MaxAge;
+	Desc->Valid = Valid;
+}
+
+/*----------------------------------------------------------------------------*/
+static void DescRemove(char *Location) {
+	for (tDesc **p = &glDescCache; *p; p = &(*p)->Next) {
+		tDesc *Desc = *p;
+		if (strcmp(Desc->Location, Location)) continue;
+		*p = Desc->Next;
+		free(Desc->Location);
+		free(Desc);
+		break;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+static void PostFetch(int Type, char *Location, char *UDN, struct sMR *Device, int MaxAge) {
+	tFetch *Fetch = calloc(1, sizeof(tFetch));
+
+	Fetch->Type = Type;
+	Fetch->Location = strdup(Location);
+	Fetch->UDN = UDN ? strdup(UDN) : NULL;
+	Fetch->Device = Device;
+	Fetch->MaxAge = MaxAge;
+	queue_init(&Fetch->Deferred, false, FreeUpdate);
+
+	// fetch thread must not look into a device that might go away meanwhile
+	if (Device) Fetch->Service[TOPOLOGY_IDX] = Device->Service[TOPOLOGY_IDX];
+
+	Fetch->Next = glFetching;
+	glFetching = Fetch;
+
+	pthread_mutex_lock(&glFetchMutex);
+	queue_insert(&glFetchQueue, Fetch);
+	pthread_cond_signal(&glFetchCond);
+	pthread_mutex_unlock(&glFetchMutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static void FetchRenderer(tFetch *Fetch) {
+	char *ModelName = XMLGetFirstDocumentItem(Fetch->DescDoc, "modelName", true);
+	bool Excluded = ModelName && isExcluded(ModelName);
+
+	NFREE(ModelName);
+	if (Excluded || !isRenderer(Fetch->DescDoc)) return;
+
+	/* find the different services */
+	for (int i = 0; i < NB_SRV; i++) {
+		char *ServiceId = NULL, *ServiceType = NULL;
+		char *EventURL = NULL, *ControlURL = NULL;
+		char *ServiceURL = NULL;
+		if (XMLFindAndParseService(Fetch->DescDoc, Fetch->Location, cSearchedSRV[i].name, &ServiceType, &ServiceId, &EventURL, &ControlURL, &ServiceURL)) {
+			struct sService *s = &Fetch->Service[cSearchedSRV[i].idx];
+			LOG_SDEBUG("\tservice [%s] %s %s, %s, %s", cSearchedSRV[i].name, ServiceType, ServiceId, EventURL, ControlURL);
+
+			strncpy(s->Id, ServiceId, RESOURCE_LENGTH-1);
+			strncpy(s->ControlURL, ControlURL, RESOURCE_LENGTH-1);
+			strncpy(s->EventURL, EventURL, RESOURCE_LENGTH - 1);
+			strncpy(s->Type, ServiceType, RESOURCE_LENGTH - 1);
+			s->TimeOut = cSearchedSRV[i].TimeOut;
+		}
+		NFREE(ServiceId);
+		NFREE(ServiceType);
+		NFREE(EventURL);
+		NFREE(ControlURL);
+
+		// gapless and extended information depend on AVTransport actions
+		if (ServiceURL && cSearchedSRV[i].idx == AVT_SRV_IDX) {
+			char *URL = malloc(strlen(Fetch->Location) + strlen(ServiceURL) + 1 + 10);
+			UpnpResolveURL(Fetch->Location, ServiceURL, URL);
+			DownloadDescDoc(URL, &Fetch->AVTDoc, DESC_TIMEOUT);
+			free(URL);
+		}
+
+		NFREE(ServiceURL);
+	}
+
+	if (*Fetch->Service[CNX_MGR_IDX].ControlURL) {
+		Fetch->ProtocolInfo = GetProtocolInfo(&Fetch->Service[CNX_MGR_IDX], DESC_TIMEOUT);
+	}
+
+	if (*Fetch->Service[TOPOLOGY_IDX].ControlURL) {
+		SendAction(&Fetch->Service[TOPOLOGY_IDX], "GetZoneGroupState", &Fetch->Topology, DESC_TIMEOUT);
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+static void *FetchThread(void *args) {
+	pthread_mutex_lock(&glFetchMutex);
+
 	while (glMainRunning) {
-		tUpdate *Update;
-		bool updated = false;
+		tFetch *Fetch = queue_extract(&glFetchQueue);
+
+		if (!Fetch) {
+			pthread_cond_wait(&glFetchCond, &glFetchMutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&glFetchMutex);
+
+		// Sonos gives us its name with topology, no need to download DescDoc then
+		if (Fetch->Type == FETCH_DESC && *Fetch->Service[TOPOLOGY_IDX].ControlURL) {
+			Fetch->rc = SendAction(&Fetch->Service[TOPOLOGY_IDX], "GetZoneGroupState", &Fetch->Topology, DESC_TIMEOUT);
+		}
+
+		if (!Fetch->Topology) {
+			Fetch->rc = DownloadDescDoc(Fetch->Location, &Fetch->DescDoc, DESC_TIMEOUT);
+			// a new renderer needs more than its description, get it here as well
+			if (Fetch->Type == FETCH_DESC && !Fetch->Device && Fetch->rc == UPNP_E_SUCCESS) FetchRenderer(Fetch);
+		}
+
+		// give result back to UpdateThread which does all devices changes
+		tUpdate *Update = calloc(1, sizeof(tUpdate));
+		Update->Type = FETCHED;
+		Update->Fetch = Fetch;
+
 		pthread_mutex_lock(&glUpdateMutex);
-		pthread_cond_wait(&glUpdateCond, &glUpdateMutex);
-		for (; glMainRunning && (Update = queue_extract(&glUpdateQueue)) != NULL; FreeUpdate(Update)) {
-			struct sMR *Device;
-			uint32_t now = gettime_ms() / 1000;
+		queue_insert(&glUpdateQueue, Update);
+		pthread_cond_signal(&glUpdateCond);
+		pthread_mutex_unlock(&glUpdateMutex);
 
-			// UPnP end of search timer
-			if (Update->Type == SEARCH_TIMEOUT) {
-				LOG_DEBUG("Presence checking", NULL);
-
-				for (int i = 0; i < MAX_RENDERERS; i++) {
-					Device = glMRDevices + i;
-					if (Device->Running && (Device->ErrorCount < 0 || Device->ErrorCount > MAX_ACTION_ERRORS ||
-						(Device->State == STOPPED && Device->Config.RemoveTimeout != -1 && 
-						 now - Device->LastSeen > Device->Config.RemoveTimeout))) {
-						// if device does not answer, try to download its DescDoc
-						IXML_Document* DescDoc = NULL;
-						if (UpnpDownloadXmlDoc(Device->DescDocURL, &DescDoc) != UPNP_E_SUCCESS) {
-							pthread_mutex_lock(&Device->Mutex);
-							LOG_INFO("[%p]: removing unresponsive player (%s)", Device, Device->friendlyName);
-							sq_delete_device(Device->SqueezeHandle);
-							// device's mutex returns unlocked
-							DelMRDevice(Device);
-						} else {
-							// device is in trouble, but let's renew grace period
-							Device->LastSeen = now;
-							Device->ErrorCount = 0;
-							LOG_INFO("[%p]: %s mute to discovery, but answers UPnP, so keep it", Device, Device->friendlyName);
-						}
-						if (DescDoc) ixmlDocument_free(DescDoc);
-					}
-				}
+		pthread_mutex_lock(&glFetchMutex);
+	}
 
-			// device removal request
-			} else if (Update->Type == BYE_BYE) {
-				Device = UDN2Device(Update->Data);
+	pthread_mutex_unlock(&glFetchMutex);
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static bool ProcessUpdate(tUpdate *Update);
+
+/*----------------------------------------------------------------------------*/
+static bool ProcessFetched(tFetch *Fetch) {
+	struct sMR *Device = Fetch->Device;
+	uint32_t now = gettime_ms() / 1000;
+	char *UDN = NULL, *ModelName = NULL;
+	bool updated = false;
+	tUpdate *Update;
+
+	// not in-flight anymore
+	for (tFetch **p = &glFetching; *p; p = &(*p)->Next) {
+		if (*p != Fetch) continue;
+		*p = Fetch->Next;
+		break;
+	}
+
+	if (Fetch->Type == FETCH_PRESENCE) {
+		if (!Device->Running || strcmp(Device->UDN, Fetch->UDN)) goto cleanup;
+
+		if (Fetch->rc != UPNP_E_SUCCESS) {
+			pthread_mutex_lock(&Device->Mutex);
+			LOG_INFO("[%p]: removing unresponsive player (%s)", Device, Device->friendlyName);
+			DescRemove(Device->DescDocURL);
+			sq_delete_device(Device->SqueezeHandle);
+			// device's mutex returns unlocked
+			DelMRDevice(Device);
+		} else {
+			// device is in trouble, but let's renew grace period
+			Device->LastSeen = now;
+			Device->ErrorCount = 0;
+			LOG_INFO("[%p]: %s mute to discovery, but answers UPnP, so keep it", Device, Device->friendlyName);
+		}
+	} else if (Device) {
+		if (!Device->Running || strcmp(Device->DescDocURL, Fetch->Location)) goto cleanup;
+
+		// Sonos gives us its name along with its master
+		struct sMR *Master = GetMaster(Device, Fetch->Topology, &Fetch->Name);
+		char *friendlyName = Fetch->Name;
+
+		// description (or Sonos topology) is good for a while
+		if (Fetch->rc == UPNP_E_SUCCESS) DescUpdate(Fetch->Location, Fetch->MaxAge, true);
+		else DescRemove(Fetch->Location);
+
+		// check for name change
+		if (!friendlyName) friendlyName = Fetch->Name = XMLGetFirstDocumentItem(Fetch->DescDoc, "friendlyName", true);
+		if (friendlyName && strcmp(friendlyName, Device->friendlyName)) {
+			// only update if LMS has not set its own name
+			if (!strcmp(Device->sq_config.name, Device->friendlyName)) {
+				// by notifying LMS, we'll get an update later
+				sq_notify(Device->SqueezeHandle, SQ_SETNAME, friendlyName);
+			}
+
+			updated = true;
+			LOG_INFO("[%p]: Name update %s => %s (LMS:%s)", Device, Device->friendlyName, friendlyName, Device->sq_config.name);
+			strcpy(Device->friendlyName, friendlyName);
+		}
+
+		// we are a master (or not a Sonos)
+		if (!Master && Device->Master) {
+			// leaving a group
+			LOG_INFO("[%p]: Sonos %s is now master", Device, Device->friendlyName);
+			pthread_mutex_lock(&Device->Mutex);
+			Device->Master = NULL;
+			Device->SqueezeHandle = sq_reserve_device(Device, Device->on, Device->MimeTypes, &sq_callback);
+			if (!*(Device->sq_config.name)) strcpy(Device->sq_config.name, Device->friendlyName);
+			sq_run_device(Device->SqueezeHandle, &Device->sq_config);
+			pthread_mutex_unlock(&Device->Mutex);
+		} else if (Master && (!Device->Master || Device->Master != Master)) {
+			// joining a group as slave
+			LOG_INFO("[%p]: Sonos %s is now slave", Device, Device->friendlyName);
+			pthread_mutex_lock(&Device->Mutex);
+			Device->Master = Master;
+			sq_delete_device(Device->SqueezeHandle);
+			Device->SqueezeHandle = 0;
+			pthread_mutex_unlock(&Device->Mutex);
+		}
+	} else {
+		IXML_Document *DescDoc = Fetch->DescDoc;
+
+		if (Fetch->rc != UPNP_E_SUCCESS) {
+			LOG_DEBUG("Error obtaining description %s -- error = %d\n", Fetch->Location, Fetch->rc);
+			DescRemove(Fetch->Location);
+			goto cleanup;
+		}
+
+		// not a media renderer but maybe a Sonos group update
+		if (!isRenderer(DescDoc)) {
+			DescUpdate(Fetch->Location, Fetch->MaxAge, false);
+			goto cleanup;
+		}
+
+		ModelName = XMLGetFirstDocumentItem(DescDoc, "modelName", true);
+		UDN = XMLGetFirstDocumentItem(DescDoc, "UDN", true);
+		// excluded device
+		if (ModelName && isExcluded(ModelName)) {
+			DescUpdate(Fetch->Location, Fetch->MaxAge, false);
+			goto cleanup;
+		}
+
+		// new device so search a free spot (this function is not called recursively)
+		Device = NewMRDevice();
+
+		// no more room !
+		if (!Device) {
+			LOG_ERROR("Can't create uPNP device (max:%u)", MAX_RENDERERS);
+			goto cleanup;
+		}
+
+		updated = true;
+
+		DescUpdate(Fetch->Location, Fetch->MaxAge, true);
 
-				// Multiple bye-bye might be sent
-				if (!CheckAndLock(Device)) continue;
+		// poll threads and UPnP callbacks must wait until the device is complete
+		pthread_mutex_lock(&Device->Mutex);
 
-				LOG_INFO("[%p]: renderer bye-bye: %s", Device, Device->friendlyName);
-				sq_delete_device(Device->SqueezeHandle);
+		if (AddMRDevice(Device, UDN, Fetch) && !glDiscovery) {
+			// create a new slimdevice
+			Device->SqueezeHandle = sq_reserve_device(Device, Device->on, Device->MimeTypes, &sq_callback);
+			if (!*(Device->sq_config.name)) strcpy(Device->sq_config.name, Device->friendlyName);
+			if (!Device->SqueezeHandle || !sq_run_device(Device->SqueezeHandle, &Device->sq_config)) {
+				sq_release_device(Device->SqueezeHandle);
+				Device->SqueezeHandle = 0;
+				LOG_ERROR("[%p]: cannot create squeezelite instance (%s)", Device, Device->friendlyName);
 				// device's mutex returns unlocked
 				DelMRDevice(Device);
-			// device keepalive or search response
-			} else if (Update->Type == DISCOVERY) {
-				IXML_Document *DescDoc = NULL;
-				char *UDN = NULL, *ModelName = NULL;
-
-				// it's a Sonos group announce, just do a targeted search and exit
-				if (strstr(Update->Data, "group_description")) {
-					for (int i = 0; i < MAX_RENDERERS; i++) {
-						Device = glMRDevices + i;
-						if (Device->Running && *Device->Service[TOPOLOGY_IDX].ControlURL)
-							UpnpSearchAsync(glControlPointHandle, 5, Device->UDN, Device);
-					}
-					continue;
-				}
+				goto cleanup;
+			}
+		}
 
-				// existing device ?
-				for (int i = 0; i < MAX_RENDERERS; i++) {
-					Device = glMRDevices + i;
-					if (Device->Running && !strcmp(Device->DescDocURL, Update->Data)) {
-						char *friendlyName = NULL;
-						struct sMR *Master = GetMaster(Device, &friendlyName);
-						Device->LastSeen = now;
-						LOG_DEBUG("[%p] UPnP keep alive: %s", Device, Device->friendlyName);
-						// check for name change
-						UpnpDownloadXmlDoc(Update->Data, &DescDoc);
-						if (!friendlyName) friendlyName = XMLGetFirstDocumentItem(DescDoc, "friendlyName", true);
-						if (friendlyName && strcmp(friendlyName, Device->friendlyName)) {
-							// only update if LMS has not set its own name
-							if (!strcmp(Device->sq_config.name, Device->friendlyName)) {
-								// by notifying LMS, we'll get an update later
-								sq_notify(Device->SqueezeHandle, SQ_SETNAME, friendlyName);
-							}
-
-							updated = true;
-							LOG_INFO("[%p]: Name update %s => %s (LMS:%s)", Device, Device->friendlyName, friendlyName, Device->sq_config.name);
-							strcpy(Device->friendlyName, friendlyName);
-						}
-
-						NFREE(friendlyName);
-
-						// we are a master (or not a Sonos)
-						if (!Master && Device->Master) {
-							// leaving a group
-							LOG_INFO("[%p]: Sonos %s is now master", Device, Device->friendlyName);
-							pthread_mutex_lock(&Device->Mutex);
-							Device->Master = NULL;
-							Device->SqueezeHandle = sq_reserve_device(Device, Device->on, Device->MimeTypes, &sq_callback);
-							if (!*(Device->sq_config.name)) strcpy(Device->sq_config.name, Device->friendlyName);
-							sq_run_device(Device->SqueezeHandle, &Device->sq_config);
-							pthread_mutex_unlock(&Device->Mutex);
-						} else if (Master && (!Device->Master || Device->Master != Master)) {
-							// joining a group as slave
-							LOG_INFO("[%p]: Sonos %s is now slave", Device, Device->friendlyName);
-							pthread_mutex_lock(&Device->Mutex);
-							Device->Master = Master;
-							sq_delete_device(Device->SqueezeHandle);
-							Device->SqueezeHandle = 0;
-							pthread_mutex_unlock(&Device->Mutex);
-						}
-						goto cleanup;
-					}
-				}
+		pthread_mutex_unlock(&Device->Mutex);
+	}
 
-				// this can take a very long time, too bad for the queue...
-				int rc;
-				if ((rc = UpnpDownloadXmlDoc(Update->Data, &DescDoc)) != UPNP_E_SUCCESS) {
-					LOG_DEBUG("Error obtaining description %s -- error = %d\n", Update->Data, rc);
-					goto cleanup;
-				}
+cleanup:
+	NFREE(UDN);
+	NFREE(ModelName);
 
-				// not a media renderer but maybe a Sonos group update
-				bool ValidRenderer = false;
-				for (size_t i = 0; !ValidRenderer && glDiscoveryPatterns[i]; i++) {
-					ValidRenderer = XMLMatchDocumentItem(DescDoc, "deviceType", glDiscoveryPatterns[i], false);
-				}
-				if (!ValidRenderer) goto cleanup;
+	// now apply, in order, what has been received for that device in the meantime
+	while ((Update = queue_extract(&Fetch->Deferred)) != NULL) updated |= ProcessUpdate(Update);
 
-				ModelName = XMLGetFirstDocumentItem(DescDoc, "modelName", true);
-				UDN = XMLGetFirstDocumentItem(DescDoc, "UDN", true);
-				// excluded device
-				if (ModelName && isExcluded(ModelName)) {
-					goto cleanup;
-				}
+	return updated;
+}
+
+/*----------------------------------------------------------------------------*/
+static bool DeferUpdate(tUpdate *Update, const char *Location, const char *UDN) {
+	tFetch *Fetch = Fetching(Location, UDN);
 
-				// new device so search a free spot - as this function is not called
-				// recursively, no need to lock the device's mutex
-				for (Device = glMRDevices; Device->Running && Device < glMRDevices + MAX_RENDERERS; Device++);
+	if (!Fetch) return false;
 
-				// no more room !
-				if (Device == glMRDevices + MAX_RENDERERS) {
-					LOG_ERROR("Too many uPNP devices (max:%u)", MAX_RENDERERS);
-					goto cleanup;
-				}
+	// a pending fetch will be fresh enough for a simple discovery
+	if (Update->Type == DISCOVERY && !Fetch->nDeferred) {
+		LOG_DEBUG("coalescing discovery of %s", Update->Data);
+		FreeUpdate(Update);
+	} else {
+		queue_insert(&Fetch->Deferred, Update);
+		Fetch->nDeferred++;
+	}
 
-				updated = true;
-
-				if (AddMRDevice(Device, UDN, DescDoc, Update->Data) && !glDiscovery) {
-					// create a new slimdevice
-					Device->SqueezeHandle = sq_reserve_device(Device, Device->on, Device->MimeTypes, &sq_callback);
-					if (!*(Device->sq_config.name)) strcpy(Device->sq_config.name, Device->friendlyName);
-					if (!Device->SqueezeHandle || !sq_run_device(Device->SqueezeHandle, &Device->sq_config)) {
-						sq_release_device(Device->SqueezeHandle);
-						Device->SqueezeHandle = 0;
-						LOG_ERROR("[%p]: cannot create squeezelite instance (%s)", Device, Device->friendlyName);
-						DelMRDevice(Device);
-					}
-				}
+	return true;
+}
 
-cleanup:
-				if (updated && (glAutoSaveConfigFile || glDiscovery)) {
-					LOG_DEBUG("Updating configuration %s", glConfigName);
-					SaveConfig(glConfigName, glConfigID, false);
+/*----------------------------------------------------------------------------*/
+static bool ProcessUpdate(tUpdate *Update) {
+	struct sMR *Device;
+	uint32_t now = gettime_ms() / 1000;
+	bool updated = false;
+
+	// UPnP end of search timer
+	if (Update->Type == SEARCH_TIMEOUT) {
+		LOG_DEBUG("Presence checking", NULL);
+
+		for (int i = 0, Count = GetMRCount(); i < Count; i++) {
+			Device = glMRDevices[i];
+			if (Device->Running && (Device->ErrorCount < 0 || Device->ErrorCount > MAX_ACTION_ERRORS ||
+				(Device->State == STOPPED && Device->Config.RemoveTimeout != -1 &&
+				 now - Device->LastSeen > Device->Config.RemoveTimeout))) {
+				// if device does not answer, try to download its DescDoc (unless already doing so)
+				if (!Fetching(Device->DescDocURL, Device->UDN)) {
+					PostFetch(FETCH_PRESENCE, Device->DescDocURL, Device->UDN, Device, 0);
 				}
+			}
+		}
+
+	// device removal request
+	} else if (Update->Type == BYE_BYE) {
+		Device = UDN2Device(Update->Data);
+
+		// something is pending for this device, so don't re-order
+		if (DeferUpdate(Update, Device ? Device->DescDocURL : NULL, Update->Data)) return false;
 
-				NFREE(UDN);
-				NFREE(ModelName);
-				if (DescDoc) ixmlDocument_free(DescDoc);
+		// Multiple bye-bye might be sent
+		if (CheckAndLock(Device)) {
+			LOG_INFO("[%p]: renderer bye-bye: %s", Device, Device->friendlyName);
+			DescRemove(Device->DescDocURL);
+			sq_delete_device(Device->SqueezeHandle);
+			// device's mutex returns unlocked
+			DelMRDevice(Device);
+		}
+	// device keepalive or search response
+	} else if (Update->Type == DISCOVERY) {
+		// it's a Sonos group announce, just do a targeted search and exit
+		if (strstr(Update->Data, "group_description")) {
+			for (int i = 0, Count = GetMRCount(); i < Count; i++) {
+				Device = glMRDevices[i];
+				if (Device->Running && *Device->Service[TOPOLOGY_IDX].ControlURL)
+					UpnpSearchAsync(glControlPointHandle, 5, Device->UDN, Device);
+			}
+		} else if (!DeferUpdate(Update, Update->Data, Update->UDN)) {
+			// existing device ?
+			if ((Device = DescURL2Device(Update->Data)) != NULL) {
+				Device->LastSeen = now;
+				LOG_DEBUG("[%p] UPnP keep alive: %s", Device, Device->friendlyName);
 			}
+
+			tDesc *Desc = DescLookup(Update->Data);
+
+			/* no need to re-download a description that is still valid, unless we need a
+			 * new device out of it or it's a Sonos whose group might have changed */
+			if (Desc && (Device ? !*Device->Service[TOPOLOGY_IDX].ControlURL : !Desc->Valid)) {
+				LOG_SDEBUG("using cached description for %s", Update->Data);
+			} else {
+				// description download and Sonos topology can take a long time, do it aside
+				PostFetch(FETCH_DESC, Update->Data, Update->UDN, Device, Update->MaxAge);
+			}
+		} else return false;
+	// a description (or topology) has been received
+	} else if (Update->Type == FETCHED) {
+		updated = ProcessFetched(Update->Fetch);
+	}
+
+	FreeUpdate(Update);
+	return updated;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *UpdateThread(void *args) {
+	// only released while waiting, so that fetchers can't miss a wake-up
+	pthread_mutex_lock(&glUpdateMutex);
+
+	while (glMainRunning) {
+		tUpdate *Update;
+		bool updated = false;
+
+		pthread_cond_wait(&glUpdateCond, &glUpdateMutex);
+
+		while (glMainRunning && (Update = queue_extract(&glUpdateQueue)) != NULL) {
+			updated |= ProcessUpdate(Update);
+		}
+
+		if (updated && (glAutoSaveConfigFile || glDiscovery)) {
+			LOG_DEBUG("Updating configuration %s", glConfigName);
+			SaveConfig(glConfigName, glConfigID, false);
 		}
-		// now release the update mutex (will be locked/unlocked)
-		pthread_mutex_unlock(&glUpdateMutex);
 	}
+
+	pthread_mutex_unlock(&glUpdateMutex);
 	return NULL;
 }
 
@@ -1326,8 +1674,9 @@ static void Replace(char** str, const char* what, const char* with) {
 #endif
 
 /*----------------------------------------------------------------------------*/
-static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, const char *location) {
-	char *friendlyName = NULL;
+static bool AddMRDevice(struct sMR *Device, char *UDN, tFetch *Fetch) {
+	char *friendlyName = NULL, *location = Fetch->Location;
+	IXML_Document *DescDoc = Fetch->DescDoc;
 	
 	// read parameters from default then config file
 	memcpy(&Device->Config, &glMRConfig, sizeof(tMRConfig));
@@ -1343,7 +1692,7 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	if (!strcasestr(Device->sq_config.mode, "thru") && !strcasestr(Device->sq_config.mode, "auto") &&
 		!strcasestr(Device->sq_config.mode, "mp3") && !strcasestr(Device->sq_config.mode, "aac") &&
 		!strcasestr(Device->sq_config.mode, "flac") && !strcasestr(Device->sq_config.mode, "flc") &&
-		!strcasestr(Device->sq_config.mode, "pcm"))
+		!strcasestr(Device->sq_config.mode, "pcm") && !strcasestr(Device->sq_config.mode, "adapt"))
 		strcpy(Device->sq_config.mode, "auto");
 
 	// Read key elements from description document
@@ -1365,10 +1714,12 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	Device->WaitCookie 		= Device->StartCookie = NULL;
 	Device->seqN			= NULL;
 	Device->TrackPoll 		= Device->StatePoll = 0;
+	Device->PollLast		= 0;
 	Device->Actions 		= NULL;
 	Device->NextURI 		= Device->NextProtoInfo = NULL;
 	Device->Master			= NULL;
 	Device->MimeTypes		= NULL;
+	memset(Device->DIDL, 0, sizeof(Device->DIDL));
 	if (Device->sq_config.roon_mode) {
 		Device->on = true;
 		Device->sq_config.use_cli = false;
@@ -1381,49 +1732,28 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	strcpy(Device->DescDocURL, location);
 
 	memset(&Device->NextMetaData, 0, sizeof(metadata_t));
-	memset(&Device->Service, 0, sizeof(struct sService) * NB_SRV);
-
-	/* find the different services */
-	for (int i = 0; i < NB_SRV; i++) {
-		char *ServiceId = NULL, *ServiceType = NULL;
-		char *EventURL = NULL, *ControlURL = NULL;
-		char *ServiceURL = NULL;
-		strcpy(Device->Service[i].Id, "");
-		if (XMLFindAndParseService(DescDoc, location, cSearchedSRV[i].name, &ServiceType, &ServiceId, &EventURL, &ControlURL, &ServiceURL)) {
-			struct sService *s = &Device->Service[cSearchedSRV[i].idx];
-			LOG_SDEBUG("\tservice [%s] %s %s, %s, %s", cSearchedSRV[i].name, ServiceType, ServiceId, EventURL, ControlURL);
-
-			strncpy(s->Id, ServiceId, RESOURCE_LENGTH-1);
-			strncpy(s->ControlURL, ControlURL, RESOURCE_LENGTH-1);
-			strncpy(s->EventURL, EventURL, RESOURCE_LENGTH - 1);
-			strncpy(s->Type, ServiceType, RESOURCE_LENGTH - 1);
-			s->TimeOut = cSearchedSRV[i].TimeOut;
-		}
-		NFREE(ServiceId);
-		NFREE(ServiceType);
-		NFREE(EventURL);
-		NFREE(ControlURL);
 
-		if (ServiceURL && cSearchedSRV[i].idx == AVT_SRV_IDX && !XMLFindAction(location, ServiceURL, "SetNextAVTransportURI") && Device->Config.AcceptNextURI == NEXT_GAPLESS) {
-			LOG_INFO("[%p]: player can't do gapless or gapless disabled by config (%d)", Device, Device->Config.AcceptNextURI);
-			Device->Config.AcceptNextURI = NEXT_GAPPED;
-		}
+	// services and what they offer have been queried by the fetch thread
+	memcpy(&Device->Service, &Fetch->Service, sizeof(struct sService) * NB_SRV);
 
-		if (ServiceURL && cSearchedSRV[i].idx == AVT_SRV_IDX && XMLFindAction(location, ServiceURL, "GetInfoEx")) {
-			LOG_INFO("[%p]: player has extended information", Device);
-			Device->InfoExPoll = INFOEX_POLL;
-		}
+	if (*Device->Service[AVT_SRV_IDX].ControlURL && !XMLFindAction(Fetch->AVTDoc, "SetNextAVTransportURI") && Device->Config.AcceptNextURI == NEXT_GAPLESS) {
+		LOG_INFO("[%p]: player can't do gapless or gapless disabled by config (%d)", Device, Device->Config.AcceptNextURI);
+		Device->Config.AcceptNextURI = NEXT_GAPPED;
+	}
 
-		NFREE(ServiceURL);
+	if (XMLFindAction(Fetch->AVTDoc, "GetInfoEx")) {
+		LOG_INFO("[%p]: player has extended information", Device);
+		Device->InfoExPoll = INFOEX_POLL;
 	}
 
 	// we are a slave (our master might not yet be discovered)
-	Device->Master = GetMaster(Device, &friendlyName);
+	Device->Master = GetMaster(Device, Fetch->Topology, &friendlyName);
 
 	// set remaining items now that we are sure
 	Device->Running = true;
 	strcpy(Device->friendlyName, friendlyName);
 	NFREE(friendlyName);
+	IndexMRDevice(Device);
 
 	char addr[32];
 	sscanf(location, "http://%[^:]", addr);
@@ -1438,8 +1768,8 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	}
 
 	// virtual players duplicate mac address
-	for (int i = 0; i < MAX_RENDERERS; i++) {
-		if (glMRDevices[i].Running && Device != glMRDevices + i && !memcmp(&glMRDevices[i].sq_config.mac, &Device->sq_config.mac, 6)) {
+	for (int i = 0, Count = GetMRCount(); i < Count; i++) {
+		if (glMRDevices[i]->Running && Device != glMRDevices[i] && !memcmp(&glMRDevices[i]->sq_config.mac, &Device->sq_config.mac, 6)) {
 			memset(Device->sq_config.mac, 0xbb, 2);
 			*(uint32_t*)(Device->sq_config.mac + 2) = hash32(Device->UDN);
 			LOG_INFO("[%p]: duplicated mac ... updating", Device);
@@ -1457,13 +1787,10 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	}
 
 	// get the protocol info
-	char* Sink = GetProtocolInfo(Device);
-	Device->MimeTypes = ParseProtocolInfo(Sink, Device->Config.ForcedMimeTypes);
+	Device->MimeTypes = ParseProtocolInfo(Fetch->ProtocolInfo, Device->Config.ForcedMimeTypes);
 
-	if (!Sink) {
+	if (!Fetch->ProtocolInfo) {
 		LOG_WARN("[%p] unable to get protocol info, use <forced_mimetypes>", Device);
-	} else {
-		free(Sink);
 	}
 
 	// crude check that "auto" mode can work 
@@ -1475,8 +1802,6 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	// only check codecs in thru mode
 	if (strcasestr(Device->sq_config.mode, "thru")) CheckCodecs(Device->sq_config.codecs, Device->MimeTypes);
 
-	pthread_create(&Device->Thread, NULL, &MRThread, Device);
-
 	/* subscribe here, not before */
 	for (int i = 0; i < NB_SRV; i++) if (Device->Service[i].TimeOut)
 		UpnpSubscribeAsync(glControlPointHandle, Device->Service[i].EventURL,
@@ -1486,6 +1811,14 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	return (Device->Master == NULL);
 }
 
+/*----------------------------------------------------------------------------*/
+static bool isRenderer(IXML_Document *DescDoc) {
+	for (size_t i = 0; glDiscoveryPatterns[i]; i++) {
+		if (XMLMatchDocumentItem(DescDoc, "deviceType", glDiscoveryPatterns[i], false)) return true;
+	}
+	return false;
+}
+
 /*----------------------------------------------------------------------------*/
 static bool isExcluded(char *Model) {
 	char item[STR_LEN];
@@ -1539,9 +1872,9 @@ static bool Start(void) {
 	// must be set after initialization
 	UpnpSetMaxContentLength(60000);
 
-	// device mutexes are always initialized
+	// devices are created on demand and their mutex is initialized then
 	memset(&glMRDevices, 0, sizeof(glMRDevices));
-	for (int i = 0; i < MAX_RENDERERS; i++) pthread_mutex_init(&glMRDevices[i].Mutex, 0);
+	glMRCount = 0;
 	
 	//if (!*glIPaddress) strcpy(glIPaddress, UpnpGetServerIpAddress());
 	sq_init(Host, Port ? UpnpGetServerPort() : 0, glModelName);
@@ -1557,10 +1890,15 @@ static bool Start(void) {
 	pthread_mutex_init(&glUpdateMutex, 0);
 	pthread_cond_init(&glUpdateCond, 0);
 	queue_init(&glUpdateQueue, true, FreeUpdate);
+	pthread_mutex_init(&glFetchMutex, 0);
+	pthread_cond_init(&glFetchCond, 0);
+	queue_init(&glFetchQueue, false, FreeFetch);
 
 	// start the main thread
 	pthread_create(&glMainThread, NULL, &MainThread, NULL);
 	pthread_create(&glUpdateThread, NULL, &UpdateThread, NULL);
+	for (int i = 0; i < POLL_THREADS; i++) pthread_create(glPollThreads + i, NULL, &PollThread, (void*) (intptr_t) i);
+	for (int i = 0; i < FETCH_THREADS; i++) pthread_create(glFetchThreads + i, NULL, &FetchThread, NULL);
 	
 	for (size_t i = 0; glDiscoveryPatterns[i]; i++) {
 		LOG_INFO("UPnP search for %s", glDiscoveryPatterns[i]);
@@ -1580,10 +1918,18 @@ static bool Stop(void) {
 	pthread_cond_signal(&glUpdateCond);
 	pthread_join(glUpdateThread, NULL);
 
+	// fetchers might be waiting for a download to timeout
+	LOG_INFO("terminate fetch threads ...", NULL);
+	pthread_mutex_lock(&glFetchMutex);
+	pthread_cond_broadcast(&glFetchCond);
+	pthread_mutex_unlock(&glFetchMutex);
+	for (int i = 0; i < FETCH_THREADS; i++) pthread_join(glFetchThreads[i], NULL);
+
 	// simple log size management thread ... should be remove done day
 	LOG_INFO("terminate main thread ...", NULL);
 	crossthreads_wake();
 	pthread_join(glMainThread, NULL);
+	for (int i = 0; i < POLL_THREADS; i++) pthread_join(glPollThreads[i], NULL);
 	LOG_INFO("stopping UPnP devices ...", NULL);
 	FlushMRDevices();
 	LOG_DEBUG("un-register libupnp callbacks ...", NULL);
@@ -1594,12 +1940,20 @@ static bool Stop(void) {
 	// wait for UPnP to terminate to not have callbacks issues
 	pthread_mutex_destroy(&glUpdateMutex);
 	pthread_cond_destroy(&glUpdateCond);
-	for (int i = 0; i < MAX_RENDERERS; i++)	{
-		pthread_mutex_destroy(&glMRDevices[i].Mutex);
-	}
+	pthread_mutex_destroy(&glFetchMutex);
+	pthread_cond_destroy(&glFetchCond);
+	FreeMRDevices();
 
 	// remove discovered items
 	queue_flush(&glUpdateQueue);
+	queue_flush(&glFetchQueue);
+	glFetching = NULL;
+	while (glDescCache) {
+		tDesc *Desc = glDescCache;
+		glDescCache = Desc->Next;
+		free(Desc->Location);
+		free(Desc);
+	}
 	if (glConfigID) ixmlDocument_free(glConfigID);
 
 	netsock_close();
@@ -1622,8 +1976,9 @@ static void sighandler(int signum) {
 	quit = true;
 	glMainRunning = false;
 	if (!glGracefullShutdown) {
-		for (i = 0; i < MAX_RENDERERS; i++) {
-			struct sMR *p = &glMRDevices[i];
+		// can't take index lock in a signal handler, count only grows anyway
+		for (i = 0; i < glMRCount; i++) {
+			struct sMR *p = glMRDevices[i];
 			if (p->Running && p->sqState == SQ_PLAY) AVTStop(p);
 		}
 		LOG_INFO("forced exit", NULL);
@@ -1903,9 +2258,10 @@ int main(int argc, char *argv[])
 		} else if (!strcasecmp(resp, "dump") || !strcasecmp(resp, "dumpall"))	{
 			uint32_t now = gettime_ms() / 1000;
 			bool all = !strcmp(resp, "dumpall");
+			int Count = GetMRCount();
 
-			for (i = 0; i < MAX_RENDERERS; i++) {
-				struct sMR *p = &glMRDevices[i];
+			for (i = 0; i < Count; i++) {
+				struct sMR *p = glMRDevices[i];
 				bool Locked = pthread_mutex_trylock(&p->Mutex);
 
 				if (!Locked) pthread_mutex_unlock(&p->Mutex);
@@ -45,7 +45,7 @@ struct alac {
 	u64_t sttssamples;
 	bool  empty;
 	struct chunk_table *chunkinfo;
-	u32_t  *block_size, default_block_size, block_index;
+	struct mp4_sizes block_size;
 	unsigned sample_rate;
 	unsigned char channels, sample_size;
 	unsigned trak, play;
@@ -109,20 +109,19 @@ static int read_mp4_header(struct thread_ctx_s *ctx) {
 
 		// extract the total number of samples from stts
 		if (!strcmp(type, "stsz") && bytes > len) {
-			u32_t i;
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			l->default_block_size = unpackN((u32_t *) ptr); ptr += 4;
-			if (!l->default_block_size) {
-				u32_t entries = unpackN((u32_t *)ptr); ptr += 4;
-				l->block_size = malloc((entries + 1)* 4);
-				for (i = 0; i < entries; i++) {
-					l->block_size[i] = unpackN((u32_t *)ptr); ptr += 4;
-				}
-				l->block_size[entries] = 0;
-				LOG_DEBUG("[%p]: total blocksize contained in stsz %u", ctx, entries);
+			if (len < 20) {
+				LOG_ERROR("[%p]: malformed stsz (%u bytes)", ctx, len);
+				return -1;
+			}
+			if (!mp4_sizes_init(&l->block_size, ctx->streambuf->readp, len)) {
+				LOG_WARN("[%p]: malloc fail", ctx);
+				return -1;
+			}
+			if (!l->block_size.fixed) {
+				LOG_DEBUG("[%p]: total blocksize contained in stsz %u (%s)", ctx, l->block_size.entries, l->block_size.runs ? "runs" : "plain");
 			} else {
-				LOG_DEBUG("[%p]: fixed blocksize in stsz %u", ctx, l->default_block_size);
-            }
+				LOG_DEBUG("[%p]: fixed blocksize in stsz %u", ctx, l->block_size.fixed);
+			}
 		}
 
 		// extract the total number of samples from stts
@@ -217,7 +216,6 @@ static int read_mp4_header(struct thread_ctx_s *ctx) {
 					}
 				}
 				l->sample = l->nextchunk = 1;
-				l->block_index = 0;
 				return 1;
 			} else {
 				LOG_DEBUG("[%p]: type: mdat len: %u, no playable track found", ctx, len);
@@ -250,18 +248,8 @@ static int read_mp4_header(struct thread_ctx_s *ctx) {
 			}
 		}
 
-		// default to consuming entire box
-		consume = len;
-
-		// read into these boxes so reduce consume
-		if (!strcmp(type, "moov") || !strcmp(type, "trak") || !strcmp(type, "mdia") || !strcmp(type, "minf") || !strcmp(type, "stbl") ||
-			!strcmp(type, "udta") || !strcmp(type, "ilst")) {
-			consume = 8;
-		}
-		// special cases which mix mix data in the enclosing box which we want to read into
-		if (!strcmp(type, "stsd")) consume = 16;
-		if (!strcmp(type, "mp4a")) consume = 36;
-		if (!strcmp(type, "meta")) consume = 12;
+		// how much of the box to consume, container boxes are read into
+		consume = mp4_box_consume(type, len);
 
 		// consume rest of box if it has been parsed (all in the buffer) or is not one we want to parse
 		if (bytes >= consume) {
@@ -345,7 +333,7 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 	}
 
 	bytes = _buf_used(ctx->streambuf);
-	block_size = l->default_block_size ? l->default_block_size : l->block_size[l->block_index];
+	block_size = mp4_sizes_peek(&l->block_size);
 
 	// stream terminated
 	if (ctx->stream.state <= DISCONNECT && (bytes == 0 || block_size == 0)) {
@@ -354,11 +342,18 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 		return DECODE_COMPLETE;
 	}
 
+	// all blocks decoded, ignore whatever trails mdat
+	if (block_size == 0) {
+		_buf_inc_readp(ctx->streambuf, bytes);
+		UNLOCK_S;
+		return DECODE_RUNNING;
+	}
+
 	// enough data for coding
 	if (bytes < block_size) {
 		UNLOCK_S;
 		return DECODE_RUNNING;
-	} else if (block_size != l->default_block_size) l->block_index++;
+	} else mp4_sizes_next(&l->block_size);
 
 	bytes = min(bytes, _buf_cont_read(ctx->streambuf));
 
@@ -463,11 +458,8 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 				iptr += 2;
 			}
 		} else if (l->sample_size == 16) {
-			while (count--) {
-				*optr++ = (*(u32_t*) iptr) << 16;
-				*optr++ = (*(u32_t*) (iptr + 2)) << 16;
-				iptr += 4;
-			}
+			pcm_from_s16(optr, (s16_t*) iptr, count, 2);
+			iptr += count * 4;
 		} else if (l->sample_size == 24) {
 			while (count--) {
 				*optr++ = (*(u32_t*) iptr) << 8;
@@ -505,7 +497,7 @@ static void alac_cleanup (struct alac *l) {
 	if (l->decoder) alac_delete_decoder(l->decoder);
 	if (l->writebuf) free(l->writebuf);
 	if (l->chunkinfo) free(l->chunkinfo);
-	if (l->block_size) free(l->block_size);
+	mp4_sizes_free(&l->block_size);
 	if (l->stsc) free(l->stsc);
 	memset(l, 0, sizeof(struct alac));
 }
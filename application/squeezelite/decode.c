@@ -75,19 +75,27 @@ static void *decode_thread(struct thread_ctx_s *ctx) {
 			);
 			IF_PROCESS(
 				min_space = ctx->process.max_out_frames * BYTES_PER_FRAME;
+				if (ctx->process.draining) toend = true;
 			);
 
 			if (space > min_space && (bytes > ctx->codec->min_read_bytes || toend)) {
 
-				ctx->decode.state = ctx->codec->decode(ctx);
+				IF_DIRECT(
+					ctx->decode.state = ctx->codec->decode(ctx);
+				);
 
 				IF_PROCESS(
+					// a drain held back by a full outputbuf resumes before anything else
+					if (!ctx->process.draining) ctx->decode.state = ctx->codec->decode(ctx);
+					else ctx->decode.state = DECODE_COMPLETE;
+
 					if (ctx->process.in_frames) {
 						process_samples(ctx);
 					}
 
-					if (ctx->decode.state == DECODE_COMPLETE) {
-						process_drain(ctx);
+					// stay running until all processed frames have reached outputbuf
+					if (ctx->decode.state == DECODE_COMPLETE && !process_drain(ctx)) {
+						ctx->decode.state = DECODE_RUNNING;
 					}
 				);
 
@@ -275,18 +275,8 @@ static int read_mp4_header(unsigned long *samplerate_p, unsigned char *channels_
 			}
 		}
 
-		// default to consuming entire box
-		consume = len;
-
-		// read into these boxes so reduce consume
-		if (!strcmp(type, "moov") || !strcmp(type, "trak") || !strcmp(type, "mdia") || !strcmp(type, "minf") || !strcmp(type, "stbl") ||
-			!strcmp(type, "udta") || !strcmp(type, "ilst")) {
-			consume = 8;
-		}
-		// special cases which mix mix data in the enclosing box which we want to read into
-		if (!strcmp(type, "stsd")) consume = 16;
-		if (!strcmp(type, "mp4a")) consume = 36;
-		if (!strcmp(type, "meta")) consume = 12;
+		// how much of the box to consume, container boxes are read into
+		consume = mp4_box_consume(type, len);
 
 		// consume rest of box if it has been parsed (all in the buffer) or is not one we want to parse
 		if (bytes >= consume) {
@@ -382,7 +372,8 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 			ctx->output.direct_sample_rate = a->samplerate;
 			ctx->output.sample_rate = decode_newstream(a->samplerate, ctx->output.supported_rates, ctx);
 			ctx->output.sample_size = 16;
-			ctx->output.channels = a->channels;
+			// decoder downmixes (downMatrix) anything above stereo
+			ctx->output.channels = min(a->channels, 2);
 			ctx->output.track_start = ctx->outputbuf->writep;
 			if (ctx->output.fade_mode) _checkfade(true, ctx);
 			ctx->decode.new_stream = false;
@@ -510,16 +501,9 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 		f = min(f, frames);
 		count = f;
 
-		if (info.channels == 2) {
-			while (count--) {
-				*optr++ = *iptr++ << 8;
-				*optr++ = *iptr++ << 8;
-			}
-		} else if (info.channels == 1) {
-			while (count--) {
-				*optr++ = *iptr << 8;
-				*optr++ = *iptr++ << 8;
-			}
+		if (info.channels == 2 || info.channels == 1) {
+			pcm_from_s32(optr, iptr, count, info.channels, 8);
+			iptr += count * info.channels;
 		} else {
 			LOG_WARN("[%^p]: unsupported number of channels", ctx);
 		}
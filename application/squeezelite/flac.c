@@ -112,6 +112,39 @@ static void metadata_cb(const FLAC__StreamDecoder* decoder, const FLAC__StreamMe
 	}
 }
 
+// ITU-R BS.775 coefficients (x1000) in FLAC channel order for 3 to 8 channels, LFE is dropped
+static const u16_t downmix_coefs[][8][2] = {
+	{ {1000,0}, {0,1000}, {707,707} },												// L R C
+	{ {1000,0}, {0,1000}, {707,0}, {0,707} },										// L R Ls Rs
+	{ {1000,0}, {0,1000}, {707,707}, {707,0}, {0,707} },							// L R C Ls Rs
+	{ {1000,0}, {0,1000}, {707,707}, {0,0}, {707,0}, {0,707} },						// L R C LFE Ls Rs
+	{ {1000,0}, {0,1000}, {707,707}, {0,0}, {500,500}, {707,0}, {0,707} },			// L R C LFE Cs Ls Rs
+	{ {1000,0}, {0,1000}, {707,707}, {0,0}, {707,0}, {0,707}, {707,0}, {0,707} },	// L R C LFE Lb Rb Ls Rs
+};
+
+static void downmix(s32_t *optr, const FLAC__int32 *const buffer[], size_t offset, size_t frames, unsigned channels, int shift) {
+	const u16_t (*coefs)[2] = downmix_coefs[channels - 3];
+	s64_t gain[8][2], norm = 0;
+
+	// normalize gains so that all channels at full scale do not clip
+	for (unsigned c = 0; c < channels; c++) norm += coefs[c][0];
+	for (unsigned c = 0; c < channels; c++) {
+		gain[c][0] = ((s64_t) coefs[c][0] << 16) / norm;
+		gain[c][1] = ((s64_t) coefs[c][1] << 16) / norm;
+	}
+
+	for (size_t i = offset; i < offset + frames; i++) {
+		s64_t l = 0, r = 0;
+		for (unsigned c = 0; c < channels; c++) {
+			s64_t sample = (s64_t) buffer[c][i] * (1 << shift);
+			l += sample * gain[c][0];
+			r += sample * gain[c][1];
+		}
+		*optr++ = l >> 16;
+		*optr++ = r >> 16;
+	}
+}
+
 static FLAC__StreamDecoderReadStatus read_cb(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *want, void *client_data) {
 	size_t bytes;
 	bool end;
@@ -153,7 +186,9 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		ctx->output.direct_sample_rate = frame->header.sample_rate;
 		ctx->output.sample_rate = decode_newstream(frame->header.sample_rate, ctx->output.supported_rates, ctx);
 		ctx->output.sample_size = bits_per_sample;
-		ctx->output.channels = channels;
+		// frames are stereo, anything above is downmixed
+		ctx->output.channels = min(channels, 2);
+		if (channels > 2) LOG_INFO("[%p]: downmixing %u channels", ctx, channels);
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 
 		UNLOCK_O;
@@ -181,7 +216,9 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 
 		count = f;
 
-		if (bits_per_sample == 8) {
+		if (channels > 2 && channels <= 8) {
+			downmix(optr, buffer, frame->header.blocksize - frames, f, channels, 32 - bits_per_sample);
+		} else if (bits_per_sample == 8) {
 			while (count--) {
 				*optr++ = *lptr++ << 24;
 				*optr++ = *rptr++ << 24;
@@ -43,7 +43,7 @@ static const u8_t	FLAC_CHANNELS[] = { 1, 2, 3, 4, 5, 6, 7, 8, 2, 2, 2, 0, 0, 0,
 static const u8_t	FLAC_SAMPLE_SIZE[] = { 0, 8, 12, 0, 16, 20, 24, 0 };
 
 static u8_t crc8[256];
-static u16_t crc16[256];
+static u16_t crc16[8][256];
 
 #define FLAC_MAX_SAMPLES 0xfffffffffLL
 
@@ -212,20 +212,41 @@ static decode_state flac_decode(struct thread_ctx_s *ctx) {
 	avail = min(avail, _buf_cont_write(ctx->outputbuf));
 
 	// in CRC16 state, copy as much as we can
-	for (u8_t* iptr = ctx->streambuf->readp, *optr = ctx->outputbuf->writep; p->state == CRC16 && consumed < avail; consumed++) {
-		// if we've reached a potential SYNC word, we want to restart fresh
-		if (!p->ignore && *iptr == 0xff && (consumed == avail - 1 || (*(iptr + 1) & 0xf8) == 0xf8)) {
+	if (p->state == CRC16 && avail) {
+		u8_t *iptr = ctx->streambuf->readp, *optr = ctx->outputbuf->writep;
+		u8_t *sync = iptr + (p->ignore ? 1 : 0);
+
+		// find next potential SYNC word where we want to restart fresh (memchr is vectorized)
+		while ((sync = memchr(sync, 0xff, iptr + avail - sync)) != NULL) {
+			if (sync == iptr + avail - 1 || (sync[1] & 0xf8) == 0xf8) break;
+			sync++;
+		}
+
+		if (sync) {
+			consumed = sync - iptr;
 			p->state = SYNC;
-			break;
+		} else consumed = avail;
+
+		/* last 2 bytes read might be the crc16 itself so they are always queued. Write
+		 * queue then data up to these 2 bytes and update crc16 with what is written */
+		if (consumed) {
+			size_t head = min(consumed, 2);
+
+			p->crc16 = calc_crc16(p->queue, head, p->crc16);
+			memcpy(optr, p->queue, head);
+
+			if (consumed > 2) {
+				p->crc16 = calc_crc16(iptr, consumed - 2, p->crc16);
+				memcpy(optr + 2, iptr, consumed - 2);
+			}
+
+			if (consumed == 1) {
+				p->queue[0] = p->queue[1];
+				p->queue[1] = *iptr;
+			} else memcpy(p->queue, iptr + consumed - 2, 2);
+
+			p->ignore = false;
 		}
-			
-		// write data & update crc16 as we now know that it is not part of crc16 itself
-		p->crc16 = calc_crc16(p->queue, 1, p->crc16);
-		*optr++ = p->queue[0];
-
-		p->queue[0] = p->queue[1];
-		p->queue[1] = *iptr++;
-		p->ignore = false;
 	}
 
 	// no need to re-process flac headers
@@ -277,8 +298,13 @@ struct codec *register_flac_thru(void) {
 
 	// x^16 + x^15 + x^2 + x^0 = 0x8005
 	for (int i = 0; i < 256; i++) {
-		crc16[i] = i << 8;
-		for (int j = 0; j < 8; j++) crc16[i] = (crc16[i] & 0x8000) ? (crc16[i] << 1) ^ 0x8005 : (crc16[i] << 1);
+		crc16[0][i] = i << 8;
+		for (int j = 0; j < 8; j++) crc16[0][i] = (crc16[0][i] & 0x8000) ? (crc16[0][i] << 1) ^ 0x8005 : (crc16[0][i] << 1);
+	}
+
+	// slicing-by-8 tables: crc16[k][i] is byte i followed by k null bytes
+	for (int k = 1; k < 8; k++) {
+		for (int i = 0; i < 256; i++) crc16[k][i] = (crc16[k-1][i] << 8) ^ crc16[0][crc16[k-1][i] >> 8];
 	}
 
 	LOG_INFO("using flac thru", NULL);
@@ -476,7 +502,13 @@ static u16_t flac_block_size(u8_t block_size)
 
 /*---------------------------------------------------------------------------*/
 static inline u16_t calc_crc16(u8_t* data, size_t n, u16_t crc) {
-	while (n--) crc = (crc << 8) ^ crc16[*data++ ^ (crc >> 8)];
+	// slicing-by-8, lookups of each 8 bytes block are independent
+	for (; n >= 8; n -= 8, data += 8) {
+		crc = crc16[7][data[0] ^ (crc >> 8)] ^ crc16[6][data[1] ^ (crc & 0xff)] ^
+			  crc16[5][data[2]] ^ crc16[4][data[3]] ^ crc16[3][data[4]] ^
+			  crc16[2][data[5]] ^ crc16[1][data[6]] ^ crc16[0][data[7]];
+	}
+	while (n--) crc = (crc << 8) ^ crc16[0][*data++ ^ (crc >> 8)];
 	return crc;
 }
 
@@ -28,8 +28,7 @@ struct m4adts {
 	// following used for mp4 only
 	u32_t consume;
 	u32_t pos;
-	u32_t *frames;
-	u32_t frame_size, frame_index;
+	struct mp4_sizes frames;
 	u8_t freq_index;
 	u32_t audio_object_type;
 	u8_t channel_config;
@@ -104,21 +103,18 @@ static int read_mp4_header(struct thread_ctx_s *ctx) {
 			a->play = a->trak;
 		}
 
-		// stash sample to chunk info, assume it comes before stco
+		// build frame size index
 		if (!strcmp(type, "stsz") && bytes > len) {
-			a->frame_size = unpackN((u32_t*) (ctx->streambuf->readp + 12));
-			if (!a->frame_size) {
-				u32_t entries = unpackN((u32_t*) (ctx->streambuf->readp + 16));
-				u8_t *ptr = ctx->streambuf->readp + 20 + entries * 4;
-
-				a->frames = malloc(entries * 4);
-				a->frame_index = 0;
-				LOG_INFO("[%p]: frame table of %d entries", ctx, entries);
-				while (entries--) {
-					ptr -= 4;
-					a->frames[entries] = unpackN((u32_t*) ptr);
-				}
+			if (len < 20) {
+				LOG_ERROR("[%p]: malformed stsz (%u bytes)", ctx, len);
+				return -1;
+			}
+			if (!mp4_sizes_init(&a->frames, ctx->streambuf->readp, len)) {
+				LOG_ERROR("[%p]: can't allocate frame table", ctx);
+				return -1;
 			}
+			LOG_INFO("[%p]: frame table of %u entries (%s)", ctx, a->frames.entries,
+					 a->frames.fixed ? "fixed" : a->frames.runs ? "runs" : "plain");
 		}
 
 		// found media data, advance to start of first chunk and return
@@ -136,18 +132,8 @@ static int read_mp4_header(struct thread_ctx_s *ctx) {
 			}
 		}
 
-		// default to consuming entire box
-		consume = len;
-
-		// read into these boxes so reduce consume
-		if (!strcmp(type, "moov") || !strcmp(type, "trak") || !strcmp(type, "mdia") || !strcmp(type, "minf") || !strcmp(type, "stbl") ||
-			!strcmp(type, "udta") || !strcmp(type, "ilst")) {
-			consume = 8;
-		}
-		// special cases which mix mix data in the enclosing box which we want to read into
-		if (!strcmp(type, "stsd")) consume = 16;
-		if (!strcmp(type, "mp4a")) consume = 36;
-		if (!strcmp(type, "meta")) consume = 12;
+		// how much of the box to consume, container boxes are read into
+		consume = mp4_box_consume(type, len);
 
 		// consume rest of box if it has been parsed (all in the buffer) or is not one we want to parse
 		if (bytes >= consume) {
@@ -224,7 +210,14 @@ static decode_state m4adts_decode(struct thread_ctx_s *ctx) {
 			return DECODE_COMPLETE;
 		}
 
-		frame_size = a->frame_size ? a->frame_size : a->frames[a->frame_index];
+		frame_size = mp4_sizes_peek(&a->frames);
+
+		// all frames sent, ignore whatever trails mdat
+		if (!frame_size) {
+			_buf_inc_readp(ctx->streambuf, in);
+			UNLOCK_S;
+			return ctx->stream.state <= DISCONNECT ? DECODE_COMPLETE : DECODE_RUNNING;
+		}
 
 		out = _buf_space(ctx->outputbuf);
 		if (in < frame_size || out < frame_size + sizeof(ADTSHeader)){
@@ -232,7 +225,7 @@ static decode_state m4adts_decode(struct thread_ctx_s *ctx) {
 			return DECODE_RUNNING;
 		}
 
-		a->frame_index++;
+		mp4_sizes_next(&a->frames);
 		in = min(in, _buf_cont_read(ctx->streambuf));
 
 		// simplify copy by handling wrap case
@@ -276,19 +269,18 @@ static void m4adts_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t
 	struct m4adts *a = ctx->decode.handle;
 
 	if (!a) {
-		a = ctx->decode.handle = malloc(sizeof(struct m4adts));
+		a = ctx->decode.handle = calloc(1, sizeof(struct m4adts));
 		if (!a) return;
-		a->frames = NULL;
 	}
 
 	a->play = a->pos = a->consume = 0;
-	if (a->frames) free(a->frames);
+	mp4_sizes_free(&a->frames);
 }
 
 static void m4adts_close(struct thread_ctx_s *ctx) {
 	struct m4adts *a = ctx->decode.handle;
 
-	if (a->frames) free(a->frames);
+	mp4_sizes_free(&a->frames);
 	free(a);
 	ctx->decode.handle = NULL;
 }
@@ -84,17 +84,6 @@ static log_level *loglevel = &decode_loglevel;
 #define MAD(h, fn, ...) (h)->mad_##fn(__VA_ARGS__)
 #endif
 
-// based on libmad minimad.c scale
-static inline u32_t scale(mad_fixed_t sample) {
-	sample += (1L << (MAD_F_FRACBITS - 24));
-
-	if (sample >= MAD_F_ONE)
-		sample = MAD_F_ONE - 1;
-	else if (sample < -MAD_F_ONE)
-		sample = -MAD_F_ONE;
-
-	return (s32_t)((sample >> (MAD_F_FRACBITS + 1 - 24)) << 8);
-}
 
 // check for id3.2 tag at start of file - http://id3.org/id3v2.4.0-structure, return length
 static unsigned _check_id3_tag(size_t bytes, struct thread_ctx_s *ctx) {
@@ -306,7 +295,7 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 		LOG_SDEBUG("[%p]: write %u frames", ctx, frames);
 
 		while (frames > 0) {
-			size_t f, count;
+			size_t f;
 			s32_t *optr = NULL;
 
 			IF_DIRECT(
@@ -318,12 +307,10 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 				optr = (s32_t *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
 			);
 
-			count = f;
-
-			while (count--) {
-				*optr++ = scale(*iptrl++);
-				*optr++ = scale(*iptrr++);
-			}
+			// based on libmad minimad.c scale
+			pcm_from_fixed(optr, iptrl, iptrr, f, MAD_F_FRACBITS);
+			iptrl += f;
+			iptrr += f;
 
 			frames -= f;
 
@@ -39,7 +39,8 @@
 #define LOCK_P   mutex_lock(ctx->mutex)
 #define UNLOCK_P mutex_unlock(ctx->mutex)
 
-struct thread_ctx_s thread_ctx[MAX_PLAYER];
+struct thread_ctx_s *thread_ctx[MAX_PLAYER];
+int					thread_count;
 struct in_addr		sq_local_host;
 u16_t				sq_local_port;
 char				sq_model_name[STR_LEN];
@@ -48,6 +49,7 @@ char				sq_model_name[STR_LEN];
 /* locals */
 /*----------------------------------------------------------------------------*/
 static void sq_wipe_device(struct thread_ctx_s *ctx);
+static struct thread_ctx_s *handle2ctx(sq_dev_handle_t handle);
 
 extern log_level	 slimmain_loglevel;
 static log_level	*loglevel = &slimmain_loglevel;
@@ -77,13 +79,24 @@ void sq_wipe_device(struct thread_ctx_s *ctx) {
 	for (i = 0; ctx->mimetypes[i]; i++) free(ctx->mimetypes[i]);
 }
 
+/*--------------------------------------------------------------------------*/
+static struct thread_ctx_s *handle2ctx(sq_dev_handle_t handle) {
+	int idx = (handle & 0xffff) - 1;
+
+	/* handle is index + 1 and a generation, so that a handle kept by caller
+	   can't reach the next player that re-uses the same context */
+	if (handle <= 0 || idx < 0 || idx >= thread_count) return NULL;
+	if (!thread_ctx[idx] || thread_ctx[idx]->self != handle) return NULL;
+
+	return thread_ctx[idx];
+}
+
 /*--------------------------------------------------------------------------*/
 void sq_delete_device(sq_dev_handle_t handle) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = handle2ctx(handle);
 
-	if (!handle) return;
+	if (!ctx) return;
 
-	ctx = &thread_ctx[handle - 1];
 	sq_wipe_device(ctx);
 }
 
@@ -271,14 +284,14 @@ char *cli_send_cmd(char *cmd, bool req, bool decode, struct thread_ctx_s *ctx) {
 
 /*--------------------------------------------------------------------------*/
 u32_t sq_get_time(sq_dev_handle_t handle) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = handle2ctx(handle);
 	char cmd[128];
 	char *rsp;
 	u32_t time = 0;
 
-	if (!ctx->config.use_cli) return 0;
+	if (ctx && !ctx->config.use_cli) return 0;
 
-	if (!handle || !ctx->in_use) {
+	if (!ctx || !ctx->in_use) {
 		LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
 		return 0;
 	}
@@ -298,13 +311,13 @@ u32_t sq_get_time(sq_dev_handle_t handle) {
 
 /*---------------------------------------------------------------------------*/
 bool sq_set_time(sq_dev_handle_t handle, char *pos) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = handle2ctx(handle);
 	char cmd[128];
 	char *rsp;
 
-	if (!ctx->config.use_cli) return false;
+	if (ctx && !ctx->config.use_cli) return false;
 
-	if (!handle || !ctx->in_use) {
+	if (!ctx || !ctx->in_use) {
 		LOG_ERROR("[%p]: no handle or cli socket %d", ctx, handle);
 		return false;
 	}
@@ -324,15 +337,15 @@ bool sq_set_time(sq_dev_handle_t handle, char *pos) {
 
 /*--------------------------------------------------------------------------*/
 uint32_t sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, int token) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = handle2ctx(handle);
 	char cmd[1024];
 	char *rsp, *p, *cur;
 	int index = token;
 
 	metadata_init(metadata);
 	
-	if (!handle || !ctx->in_use || !ctx->config.use_cli) {
-		if (ctx->config.use_cli) {
+	if (!ctx || !ctx->in_use || !ctx->config.use_cli) {
+		if (!ctx || ctx->config.use_cli) {
 			LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
 		}
 		metadata_defaults(metadata);
@@ -488,11 +501,11 @@ uint32_t sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, int token
 
 /*--------------------------------------------------------------------------*/
 u32_t sq_self_time(sq_dev_handle_t handle) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = handle2ctx(handle);
 	u32_t time;
 	u32_t now = gettime_ms();
 
-	if (!handle || !ctx->in_use) return 0;
+	if (!ctx || !ctx->in_use) return 0;
 
 	LOCK_O;
 
@@ -508,13 +521,13 @@ u32_t sq_self_time(sq_dev_handle_t handle) {
 
 /*---------------------------------------------------------------------------*/
 void sq_notify(sq_dev_handle_t handle, sq_event_t event, ...) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = handle2ctx(handle);
 	char cmd[128], *rsp;
 
 	LOG_SDEBUG("[%p]: notif %d", ctx, event);
 
 	// squeezelite device has not started yet or is off ...
-	if (!ctx->running || !ctx->on || !handle || !ctx->in_use) return;
+	if (!ctx || !ctx->running || !ctx->on || !ctx->in_use) return;
 
 	va_list args;
 	va_start(args, event);
@@ -719,9 +732,9 @@ void sq_init(struct in_addr host, u16_t port, char *model_name) {
 void sq_stop() {
 	int i;
 
-	for (i = 0; i < MAX_PLAYER; i++) {
-		if (thread_ctx[i].in_use) {
-			sq_wipe_device(&thread_ctx[i]);
+	for (i = 0; i < thread_count; i++) {
+		if (thread_ctx[i]->in_use) {
+			sq_wipe_device(thread_ctx[i]);
 		}
 	}
 
@@ -732,8 +745,9 @@ void sq_stop() {
 
 /*---------------------------------------------------------------------------*/
 void sq_release_device(sq_dev_handle_t handle) {
-	if (handle) {
-		struct thread_ctx_s *ctx = thread_ctx + handle - 1;
+	struct thread_ctx_s *ctx = handle2ctx(handle);
+
+	if (ctx) {
 		int i;
 
 		ctx->in_use = false;
@@ -743,20 +757,31 @@ void sq_release_device(sq_dev_handle_t handle) {
 
 /*---------------------------------------------------------------------------*/
 sq_dev_handle_t sq_reserve_device(void *MR, bool on, char *mimetypes[], sq_callback_t callback) {
-	int idx, i;
+	int idx, i, generation = 0;
 	struct thread_ctx_s *ctx;
 
 	/* find a free thread context - this must be called in a LOCKED context */
-	for  (idx = 0; idx < MAX_PLAYER; idx++) if (!thread_ctx[idx].in_use) break;
+	for  (idx = 0; idx < thread_count; idx++) if (!thread_ctx[idx]->in_use) break;
 
-	if (idx < MAX_PLAYER) 	{
-		// this sets a LOT of data to proper defaults (NULL, false ...)
-		memset(&thread_ctx[idx], 0, sizeof(struct thread_ctx_s));
-		thread_ctx[idx].in_use = true;
-	} else return false;
+	if (idx == MAX_PLAYER) return false;
 
-	ctx = thread_ctx + idx;
-	ctx->self = idx + 1;
+	// contexts are only created when needed and then never freed
+	if (idx == thread_count) {
+		if ((ctx = malloc(sizeof(struct thread_ctx_s))) == NULL) return false;
+	} else {
+		ctx = thread_ctx[idx];
+		generation = ((ctx->self >> 16) + 1) & 0x7fff;
+	}
+
+	// this sets a LOT of data to proper defaults (NULL, false ...)
+	memset(ctx, 0, sizeof(struct thread_ctx_s));
+	ctx->in_use = true;
+	ctx->self = (generation << 16) | (idx + 1);
+
+	if (idx == thread_count) {
+		thread_ctx[idx] = ctx;
+		thread_count++;
+	}
 	ctx->on = on;
 	ctx->callback = callback;
 	ctx->MR = MR;
@@ -764,13 +789,15 @@ sq_dev_handle_t sq_reserve_device(void *MR, bool on, char *mimetypes[], sq_callb
 	// copy the content-type capabilities of the player
 	for (i = 0; i < MAX_MIMETYPES && mimetypes[i]; i++) ctx->mimetypes[i] = strdup(mimetypes[i]);
 
-	return idx + 1;
+	return ctx->self;
 }
 
 
 /*---------------------------------------------------------------------------*/
 bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = handle2ctx(handle);
+
+	if (!ctx) return false;
 
 	memcpy(&ctx->config, param, sizeof(sq_dev_param_t));
 
@@ -797,10 +824,11 @@ bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param) {
 
 /*--------------------------------------------------------------------------*/
 void *sq_get_ptr(sq_dev_handle_t handle) {
-	return handle ? thread_ctx + handle - 1 : NULL;
+	return handle2ctx(handle);
 }
 
 /*--------------------------------------------------------------------------*/
 bool sq_icy_active(sq_dev_handle_t handle) {
-	return handle ? thread_ctx[handle - 1].render.index != -1 && thread_ctx[handle - 1].render.icy : false;
+	struct thread_ctx_s *ctx = handle2ctx(handle);
+	return ctx ? ctx->render.index != -1 && ctx->render.icy : false;
 }
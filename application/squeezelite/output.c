@@ -51,6 +51,11 @@ static void 	scale_and_pack(void *dst, u32_t *src, size_t frames, u8_t channels,
 							   u8_t sample_size, int endian);
 #if CODECS
 static void 	to_mono(s32_t *iptr,  size_t frames);
+static void 	*output_pool(struct outputstate *out, int slot, size_t size);
+static u64_t	gettime_us(void);
+static void		flac_auto_level(struct thread_ctx_s *ctx);
+static bool		adapt_supported(int step, struct thread_ctx_s *ctx);
+static u32_t	adapt_rate(int step, struct outputstate *out);
 static int 		shine_make_config_valid(int freq, int *bitr);
 static FLAC__StreamEncoderWriteStatus flac_write_callback(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, void *client_data);
 
@@ -83,6 +88,23 @@ static struct {
 // careful, this should not be more than 1/8 of obuf size
 #define FLAC_MAX_FRAMES	4096
 #define FLAC_MIN_SPACE	(FLAC_MAX_FRAMES * BYTES_PER_FRAME)
+#define FLAC_MAX_LEVEL	8
+#define FLAC_AUTO_LOAD	25		// max % of realtime spent encoding with flc:cpu
+#define ADAPT_UP		200		// step up if renderer took more than this % of next step's realtime
+
+// from best to worst, steps not supported by the renderer are skipped
+static struct {
+	encode_mode mode;
+	int param;			// FLAC level or bitrate
+} adapt_ladder[] = {
+	{ ENCODE_PCM, 0 },
+	{ ENCODE_FLAC, 5 },
+	{ ENCODE_MP3, 320 },
+	{ ENCODE_AAC, 256 },
+	{ ENCODE_MP3, 192 },
+	{ ENCODE_AAC, 160 },
+	{ ENCODE_MP3, 128 },
+};
 
 #define DRAIN_LEN		3
 #define MAX_FRAMES_SEC 	10
@@ -201,7 +223,7 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 	but for simplicity we won't process anything until it has free space for the
 	smallest block of audio which is BYTES_PER_FRAME
 	Except for THRU mode, outputbuf->writep is always aligned to a multiple of
-	BYTES_PER_FRAME when starting a	new track
+	BYTES_PER_FRAME when starting a	new track (native PCM pads its end for that)
 	Output buffer (buf) cannot have an alignement due to additon of header  for
 	wav and aif files
 	*/
@@ -219,7 +241,7 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 
 		if (!p->header.count) {
 			LOG_INFO("[%p]: PCM header sent (%u bytes)", ctx, p->header.size);
-			NFREE(p->header.buffer);
+			p->header.buffer = NULL;
 		}
 
 		return true;
@@ -228,8 +250,8 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 	bytes = min(bytes, _buf_cont_read(ctx->outputbuf));
 
 	// now proceeding audio data
-	if (p->encode.mode == ENCODE_THRU) {
-		//	simple encoded audio, nothing to process, just forward outputbuf
+	if (p->encode.mode == ENCODE_THRU || (p->encode.mode == ENCODE_PCM && p->encode.native)) {
+		//	simple encoded audio or native pcm, nothing to process, just forward outputbuf
 		bytes = min(bytes, _buf_cont_write(buf));
 		memcpy(buf->writep, ctx->outputbuf->readp, bytes);
 		_buf_inc_writep(buf, bytes);
@@ -338,7 +360,10 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 			if (!frames) return true;
 
 			if (p->encode.channels == 1) to_mono((s32_t*) ctx->outputbuf->readp, frames);
+			u64_t start = gettime_us();
 			FLAC(f, stream_encoder_process_interleaved, p->encode.codec, (FLAC__int32*) ctx->outputbuf->readp, frames);
+			p->flac.us += gettime_us() - start;
+			p->flac.frames += frames;
 		} else if (p->encode.mode == ENCODE_MP3) {
 			if (!p->encode.codec) return false;
 
@@ -423,11 +448,124 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 	return (bytes != 0);
 }
 
+/*---------------------------------------------------------------------------*/
+static bool adapt_supported(int step, struct thread_ctx_s *ctx) {
+	switch (adapt_ladder[step].mode) {
+	case ENCODE_PCM: return mimetype_match_codec(ctx->mimetypes, 3, "wav", "aif", "audio/L");
+	case ENCODE_FLAC: return mimetype_match_codec(ctx->mimetypes, 1, "flac");
+	case ENCODE_MP3: return mimetype_match_codec(ctx->mimetypes, 2, "mp3", "mpeg");
+#if LINKALL
+	case ENCODE_AAC: return mimetype_match_codec(ctx->mimetypes, 1, "aac");
+#endif
+	default: return false;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t adapt_rate(int step, struct outputstate *out) {
+	// use what previous track was encoded with as an estimate
+	u32_t rate = out->encode.sample_rate ? out->encode.sample_rate : 44100;
+	u32_t pcm = rate * (out->encode.channels ? out->encode.channels : 2) * (out->encode.sample_size ? out->encode.sample_size : 16) / 8;
+
+	switch (adapt_ladder[step].mode) {
+	case ENCODE_PCM: return pcm;
+	case ENCODE_FLAC: return pcm * 0.7;
+	default: return adapt_ladder[step].param * 1000 / 8;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+encode_mode output_adapt(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	int step = out->adapt.step, count = ARRAY_COUNT(adapt_ladder);
+
+	if (step < 0) {
+		// start from the best the renderer can take
+		for (step = 0; step < count - 1 && !adapt_supported(step, ctx); step++);
+		LOG_INFO("[%p]: adaptive mode starts at step %d (mode:%d param:%d)", ctx, step, adapt_ladder[step].mode, adapt_ladder[step].param);
+	} else if (out->adapt.capacity || out->adapt.behind) {
+		// only set when renderer was measured (not paced, not live)
+		int next = step;
+
+		// step down only if renderer could not keep up with realtime, going up needs a good margin
+		if (out->adapt.behind) {
+			while (++next < count && !adapt_supported(next, ctx));
+		} else {
+			while (--next >= 0 && !adapt_supported(next, ctx));
+			if (next >= 0 && out->adapt.capacity < (u64_t) adapt_rate(next, out) * ADAPT_UP / 100) next = step;
+		}
+
+		if (next >= 0 && next < count && next != step) {
+			LOG_INFO("[%p]: adaptive mode step %d => %d (mode:%d param:%d) with %u B/s for %u B/s", ctx, step, next,
+					 adapt_ladder[next].mode, adapt_ladder[next].param, out->adapt.capacity, adapt_rate(step, out));
+			step = next;
+		} else {
+			LOG_INFO("[%p]: adaptive mode stays at step %d with %u B/s for %u B/s", ctx, step, out->adapt.capacity, adapt_rate(step, out));
+		}
+	}
+
+	out->adapt.capacity = 0;
+	out->adapt.behind = false;
+	out->adapt.step = step;
+	out->adapt.param = adapt_ladder[step].param;
+
+	return adapt_ladder[step].mode;
+}
+
+/*---------------------------------------------------------------------------*/
+static u64_t gettime_us(void) {
+#if WIN
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (count.QuadPart * 1000000) / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+static void flac_auto_level(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+
+	// need a few seconds to have a meaningful measure
+	if (!out->flac.frames || out->flac.frames < out->encode.sample_rate * 10) return;
+
+	/* this is wall time, so it accounts for other players encoding at the same time and
+	 * for whatever else the host is doing. Going one level up costs more than going one
+	 * down saves, so leave some room before moving up */
+	u32_t load = (out->flac.us * out->encode.sample_rate) / (out->flac.frames * 10000);
+	int level = out->flac.level;
+
+	if (load > FLAC_AUTO_LOAD && level > 0) level--;
+	else if (load < FLAC_AUTO_LOAD / 3 && level < FLAC_MAX_LEVEL) level++;
+
+	if (level != out->flac.level) {
+		LOG_INFO("[%p]: FLAC auto level %d => %d (load %u%% of realtime)", ctx, out->flac.level, level, load);
+		out->flac.level = level;
+	} else {
+		LOG_DEBUG("[%p]: FLAC auto level %d (load %u%% of realtime)", ctx, level, load);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void *output_pool(struct outputstate *out, int slot, size_t size) {
+	// memory only grows so that after a few tracks there is no allocation at all
+	if (out->pool[slot].size < size) {
+		free(out->pool[slot].data);
+		out->pool[slot].data = malloc(size);
+		out->pool[slot].size = out->pool[slot].data ? size : 0;
+	}
+	return out->pool[slot].data;
+}
+
 /*---------------------------------------------------------------------------*/
 void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *ctx) {
 	struct outputstate *out = &ctx->output;
 	u8_t *writep = obuf->writep;
-	int bitrate;
+	int bitrate = 0;
 
 	if (!out->encode.sample_rate) out->encode.sample_rate = out->sample_rate;
 	if (!out->encode.channels) out->encode.channels = out->channels;
@@ -453,7 +591,7 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 
 		switch (out->format) {
 		case 'w': {
-			struct wave_header_s *h = malloc(sizeof(struct wave_header_s));
+			struct wave_header_s *h = output_pool(out, OUTPUT_POOL_HEADER, sizeof(struct wave_header_s));
 
 			memcpy(h, &wave_header, sizeof(struct wave_header_s));
 			little16(&h->channels, out->encode.channels);
@@ -469,7 +607,7 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 		   }
 		   break;
 	   case 'i': {
-			struct aiff_header_s *h = malloc(sizeof(struct aiff_header_s));
+			struct aiff_header_s *h = output_pool(out, OUTPUT_POOL_HEADER, sizeof(struct aiff_header_s));
 
 			memcpy(h, &aiff_header, sizeof(struct aiff_header_s));
 			big16(h->channels, out->encode.channels);
@@ -489,7 +627,7 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 			out->header.size = out->header.count = 0;
 			if (out->encode.sample_size == 24 && ctx->config.L24_format == L24_PACKED_LPCM) {
 				// need room for 2 frames with L+R
-				out->encode.buffer = malloc(2 * BYTES_PER_FRAME);
+				out->encode.buffer = output_pool(out, OUTPUT_POOL_ENCODE, 2 * BYTES_PER_FRAME);
 				out->encode.count = 0;
 			}
 			// raw mode but did not get the full mimetype initially
@@ -500,6 +638,8 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 			break;
 		}
 
+		bitrate = ((u64_t) out->encode.sample_rate * out->encode.channels * out->encode.sample_size) / 1000;
+
 		// set length if required (all the time or only wehn known) but use 32 bits value with wav and aif
 		if (out->length == 0 || out->length == HTTP_LENGTH_IFKNOWN) out->length = out->format == 'p' ? length : len32;
 
@@ -508,13 +648,18 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 #if CODECS
 	} else if (out->encode.mode == ENCODE_FLAC) {
 		int level = 5;
-		if (sscanf(ctx->config.mode, "%*[^:]:%d", &level) && level > 9) level = 9;
+		if (strcasestr(ctx->config.mode, "adapt")) level = out->adapt.param;
+		else if (strcasestr(ctx->config.mode, ":cpu")) level = out->flac.level;
+		else if (sscanf(ctx->config.mode, "%*[^:]:%d", &level) == 1) level = max(0, min(level, FLAC_MAX_LEVEL));
 
 		// level are estimates absed on various tests
 		double ratio[] = { 0.8, 0.79, 0.78, 0.75, 0.72, 0.71, 0.70, 0.68, 0.65 };
 		bitrate = (out->encode.channels * out->encode.sample_size * out->encode.sample_rate * ratio[level]) / 1000;
 
-		FLAC__StreamEncoder* codec = FLAC(f, stream_encoder_new);
+		// re-use previous track's encoder if any (it has been finished)
+		FLAC__StreamEncoder* codec = out->flac.encoder ? out->flac.encoder : FLAC(f, stream_encoder_new);
+		out->flac.encoder = NULL;
+		out->flac.us = out->flac.frames = 0;
 		bool ok = FLAC(f, stream_encoder_set_verify,codec, false);
 		ok &= FLAC(f, stream_encoder_set_compression_level, codec, level);
 		ok &= FLAC(f, stream_encoder_set_channels, codec, out->encode.channels);
@@ -539,7 +684,8 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 		shine_config_t config;
 
 		bitrate = 224;
-		if (sscanf(ctx->config.mode, "%*[^:]:%d", &bitrate) && bitrate > 320) bitrate = 320;
+		if (strcasestr(ctx->config.mode, "adapt")) bitrate = out->adapt.param;
+		else if (sscanf(ctx->config.mode, "%*[^:]:%d", &bitrate) && bitrate > 320) bitrate = 320;
 
 		shine_set_config_mpeg_defaults(&config.mpeg);
 		config.wave.samplerate = out->encode.sample_rate;
@@ -554,7 +700,7 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 		out->encode.count = 0;
 		out->encode.codec = (void*) shine_initialise(&config);
 		if (out->encode.codec) {
-			out->encode.buffer = malloc(shine_samples_per_pass(out->encode.codec) * out->encode.channels * 2);
+			out->encode.buffer = output_pool(out, OUTPUT_POOL_ENCODE, shine_samples_per_pass(out->encode.codec) * out->encode.channels * 2);
 			LOG_INFO("[%p]: MP3-%u encoding r:%u s:%u c:%u", ctx,config.mpeg.bitr, out->encode.sample_rate,
 					 out->encode.sample_size, out->encode.channels);
 		} else {
@@ -563,10 +709,11 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 		}
 	} else if (out->encode.mode == ENCODE_AAC) {
 #if LINKALL
-		struct aac_private* aac = malloc(sizeof(struct aac_private));
+		struct aac_private* aac = output_pool(out, OUTPUT_POOL_CODEC, sizeof(struct aac_private));
 
 		bitrate = 160;
-		if (sscanf(ctx->config.mode, "%*[^:]:%d", &bitrate) && bitrate > 320) bitrate = 320;
+		if (strcasestr(ctx->config.mode, "adapt")) bitrate = out->adapt.param;
+		else if (sscanf(ctx->config.mode, "%*[^:]:%d", &bitrate) && bitrate > 320) bitrate = 320;
 
 		out->encode.codec = (void*) faacEncOpen(out->encode.sample_rate, out->encode.channels, &aac->in_samples, &aac->out_max_bytes);
 		out->encode.codec_private = aac;
@@ -574,8 +721,8 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 
 		if (out->encode.codec) {
 			// in_samples is the *total* number of samples, not frames and we use 16 bits for aac
-			out->encode.buffer = malloc(aac->in_samples * 2);
-			aac->buffer = malloc(aac->out_max_bytes);
+			out->encode.buffer = output_pool(out, OUTPUT_POOL_ENCODE, aac->in_samples * 2);
+			aac->buffer = output_pool(out, OUTPUT_POOL_CODEC_BUFFER, aac->out_max_bytes);
 
 			faacEncConfigurationPtr format = faacEncGetCurrentConfiguration(out->encode.codec);
 			format->bitRate = bitrate * 1000 / out->encode.channels;
@@ -588,7 +735,6 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 			LOG_INFO("[%p]: AAC-%u encoding r:%u s:%u c:%u", ctx, bitrate, out->encode.sample_rate, 
 					 out->encode.sample_size, out->encode.channels);
 		} else {
-			free(aac);
 			LOG_ERROR("[%p]: failed initializing AAC-%u r:%u s:%u c:%u", ctx, bitrate, out->encode.sample_rate,
 					  out->encode.sample_size, out->encode.channels);
 		}
@@ -608,6 +754,9 @@ void _output_new_stream(struct buffer *obuf, FILE *store, struct thread_ctx_s *c
 		LOG_INFO("[%p]: HTTP %" PRId64 " (estimated length : %" PRId64 ")", ctx, ctx->config.stream_length, out->length);
 	}
 
+	// bitrate is in kbps
+	out->byte_rate = bitrate * 1000 / 8;
+
 	if (store) {
 		size_t out, bytes = (obuf->writep - writep) % obuf->size;
 		out = min(bytes, obuf->wrap - writep);
@@ -625,8 +774,16 @@ void _output_end_stream(struct buffer *buf, struct thread_ctx_s *ctx) {
 		if (out->encode.mode == ENCODE_FLAC) {
 			// FLAC is a pain and requires a last encode call
 			LOG_INFO("[%p]: finishing FLAC", ctx);
-			if (buf) FLAC(f, stream_encoder_finish, out->encode.codec);
-			FLAC(f, stream_encoder_delete, out->encode.codec);
+			/* a finished encoder can be re-initialized, but when aborting we can't finish
+			 * as it writes into a buffer that might be gone */
+			if (buf) {
+				FLAC(f, stream_encoder_finish, out->encode.codec);
+				if (out->flac.encoder) FLAC(f, stream_encoder_delete, out->flac.encoder);
+				out->flac.encoder = out->encode.codec;
+				if (strcasestr(ctx->config.mode, ":cpu")) flac_auto_level(ctx);
+			} else {
+				FLAC(f, stream_encoder_delete, out->encode.codec);
+			}
 			out->encode.codec = NULL;
 		} else if (out->encode.mode == ENCODE_MP3) {
 			LOG_INFO("[%p]: finishing MP3", ctx);
@@ -669,16 +826,14 @@ void _output_end_stream(struct buffer *buf, struct thread_ctx_s *ctx) {
 			}
 
 			faacEncClose(out->encode.codec);
-			free(aac->buffer);
-			free(aac);
 			out->encode.codec = NULL;
 #endif
 		}
 	}
 #endif
 
-	// free any buffer
-	NFREE(out->encode.buffer);
+	// buffer goes back to the pool
+	out->encode.buffer = NULL;
 	out->encode.count = 0;
 	out->fade_writep = NULL;
 }
@@ -696,13 +851,13 @@ bool output_flush(struct thread_ctx_s *ctx, bool full) {
 
 	for (int i = 0; i < ARRAY_COUNT(ctx->output_thread); i++) {
 		if (!ctx->output_thread[i].running || (ctx->output_thread[i].lingering && !full)) continue;
-		ctx->output_thread[i].running = false;
-		UNLOCK_O;
-		LOG_INFO("[%p]: joining thread index:%d (slot:%d)", ctx, ctx->output_thread[i].index, ctx->output_thread[i].slot);
-		pthread_join(ctx->output_thread[i].thread, NULL);
-		LOCK_O;
+		LOG_INFO("[%p]: waiting thread index:%d (slot:%d)", ctx, ctx->output_thread[i].index, ctx->output_thread[i].slot);
+		_output_wait(ctx->output_thread + i);
 	}
 
+	// on a full flush, don't keep buffers of idle workers around
+	if (full) for (int i = 0; i < ARRAY_COUNT(ctx->output_thread); i++) _output_release(ctx->output_thread + i);
+
 	// this should only be done upon full flush, not just streaming
 	if (full) {
 		ctx->render.ms_played = 0;
@@ -718,7 +873,7 @@ bool output_flush(struct thread_ctx_s *ctx, bool full) {
 	ctx->output.track_start = NULL;
 	ctx->output.encode.flow = false;
 
-	NFREE(ctx->output.header.buffer);
+	ctx->output.header.buffer = NULL;
 	output_free_icy(ctx);
 	_output_end_stream(NULL, ctx);
 	_buf_resize(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
@@ -734,7 +889,7 @@ bool output_thread_init(struct thread_ctx_s *ctx) {
 	LOG_DEBUG("[%p] init output media renderer", ctx);
 
 	if (ctx->config.outputbuf_size <= OUTPUTBUF_IDLE_SIZE) ctx->config.outputbuf_size = OUTPUTBUF_SIZE;
-	else ctx->config.outputbuf_size = (ctx->config.outputbuf_size * BYTES_PER_FRAME) / BYTES_PER_FRAME;
+	else ctx->config.outputbuf_size = (ctx->config.outputbuf_size / BYTES_PER_FRAME) * BYTES_PER_FRAME;
 	ctx->outputbuf = &ctx->__o_buf;
 	buf_init(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
 
@@ -747,11 +902,25 @@ bool output_thread_init(struct thread_ctx_s *ctx) {
 	ctx->output.encode.codec = NULL;
 	ctx->output.fade_writep = NULL;
 	ctx->output.icy.artist = ctx->output.icy.title = ctx->output.icy.artwork = NULL;
+	ctx->output.header.buffer = NULL;
+	ctx->output.encode.buffer = NULL;
+	memset(ctx->output.pool, 0, sizeof(ctx->output.pool));
+	ctx->output.flac.encoder = NULL;
+	ctx->output.flac.level = 5;
+	ctx->output.adapt.step = -1;
+	ctx->output.adapt.capacity = 0;
+	ctx->output.adapt.behind = false;
 
 	for (int i = 0; i < ARRAY_COUNT(ctx->output_thread); i++) {
-		ctx->output_thread[i].running = ctx->output_thread[i].terminate = false;
-		ctx->output_thread[i].slot = i;
-		ctx->output_thread[i].http = -1;
+		struct output_thread_s *thread = ctx->output_thread + i;
+		thread->running = thread->terminate = false;
+		thread->active = thread->busy = false;
+		thread->slot = i;
+		thread->http = -1;
+		thread->ctx = ctx;
+		thread->cache = NULL;
+		thread->obuf.buf = thread->backlog.buf = NULL;
+		pthread_cond_init(&thread->cond, NULL);
 	}
 	ctx->render.index = -1;
 
@@ -761,6 +930,16 @@ bool output_thread_init(struct thread_ctx_s *ctx) {
 /*---------------------------------------------------------------------------*/
 void output_close(struct thread_ctx_s *ctx) {
 	LOG_DEBUG("[%p] close media renderer", ctx);
+	output_http_close(ctx);
+#if CODECS
+	if (ctx->output.flac.encoder) FLAC(f, stream_encoder_delete, ctx->output.flac.encoder);
+	ctx->output.flac.encoder = NULL;
+#endif
+	for (int i = 0; i < OUTPUT_POOL_MAX; i++) {
+		NFREE(ctx->output.pool[i].data);
+		ctx->output.pool[i].size = 0;
+	}
+	for (int i = 0; i < ARRAY_COUNT(ctx->output_thread); i++) pthread_cond_destroy(&ctx->output_thread[i].cond);
 	buf_destroy(ctx->outputbuf);
 }
 
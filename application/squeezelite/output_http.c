@@ -19,6 +19,13 @@
  *
  */
 
+#if !WIN
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
 #include "squeezelite.h"
 #include "cache.h"
 
@@ -48,17 +55,47 @@ static log_level 	*loglevel = &output_loglevel;
 #define MAX_BLOCK		(32*1024)
 #define TIMEOUT			50
 #define DRAIN_MAX		(5000 / TIMEOUT)
+#define MAX_FRAMES		6
+#define PACING_MARGIN	125		// in % of realtime, for VBR and clock drift
+#define ADAPT_WINDOW	5000	// time to measure what renderer takes (in ms)
+#define ADAPT_SLICE		500		// measure is checked every slice (in ms)
+#define ADAPT_THROTTLE	150		// renderer ahead of realtime and taking less than this % of it is throttling
+#define ADAPT_DOWN		95		// renderer behind realtime and taking less than this % of it can't keep up
+
+// token bucket that lets a renderer be fed ahead of realtime but not much more
+struct pacing_s {
+	u32_t	rate;				// bytes per second, 0 when not pacing
+	int64_t tokens, max;
+	u32_t	last;
+	bool	kernel;				// socket paces for us
+};
+
+// what renderer takes, only counted while it is the bottleneck
+struct adapt_s {
+	u32_t	first, last;
+	u32_t	elapsed, slice;		// time spent with data waiting for renderer, overall and in current slice
+	u64_t	total;				// everything renderer took since first send
+	size_t	bytes, slice_bytes;	// what renderer took while data was waiting, overall and in current slice
+	u32_t	peak;				// best slice
+	bool	pending, done;
+};
 
-struct thread_param_s {
-	struct thread_ctx_s* ctx;
-	struct output_thread_s* thread;
+// a piece of data to be sent, all pieces of a block go in a single syscall
+struct frame_s {
+	const void *data;
+	size_t len;
 };
 
-static void     output_http_thread(struct thread_param_s *param);
-static bool     handle_http(struct thread_ctx_s* ctx, cache_buffer* cache, bool* use_cache, bool lingering, int index, int sock);
+static void     output_http_worker(struct output_thread_s *thread);
+static void     output_http_thread(struct output_thread_s *thread);
+static bool     handle_http(struct thread_ctx_s* ctx, cache_buffer* cache, bool* use_cache, bool lingering, int index, int sock, bool *keep_alive);
 static ssize_t 	send_with_icy(struct outputstate *out, struct buffer* backlog, int sock, const void* data, size_t bytes, int flags);
-static ssize_t  send_chunked(bool chunked, struct buffer* backlog, int sock, const void* data, size_t bytes, int flags);
+static int		add_chunked(struct frame_s *frames, char *chunk, bool chunked, const void *data, size_t bytes);
+static ssize_t  send_frames(struct buffer* backlog, int sock, struct frame_s *frames, int count, int flags);
 static ssize_t  send_backlog(struct buffer* backlog, int sock, const void* data, size_t bytes, int flags);
+static void		pacing_start(struct pacing_s *pace, struct thread_ctx_s *ctx, int sock);
+static bool		pacing_hold(struct pacing_s *pace, int sock);
+static void		adapt_measure(struct adapt_s *adapt, ssize_t sent, bool pending, struct thread_ctx_s *ctx);
 
 /*---------------------------------------------------------------------------*/
 bool _output_lingers(struct thread_ctx_s* ctx, int index) {
@@ -82,9 +119,46 @@ void _output_terminate_below(struct thread_ctx_s* ctx, int index) {
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+void _output_wait(struct output_thread_s *thread) {
+	struct thread_ctx_s *ctx = thread->ctx;
+
+	// stop whatever track the worker is serving and wait till it is idle
+	thread->running = false;
+	while (thread->busy) pthread_cond_wait(&thread->cond, &ctx->outputbuf->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void _output_release(struct output_thread_s *thread) {
+	// only an idle worker's buffers can be released
+	if (thread->busy) return;
+	buf_destroy(&thread->obuf);
+	buf_destroy(&thread->backlog);
+	if (thread->cache) cache_delete(thread->cache);
+	thread->cache = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+void output_http_close(struct thread_ctx_s *ctx) {
+	LOCK_O;
+
+	for (int i = 0; i < ARRAY_COUNT(ctx->output_thread); i++) {
+		struct output_thread_s *thread = ctx->output_thread + i;
+		if (!thread->active) continue;
+		_output_wait(thread);
+		thread->active = false;
+		pthread_cond_broadcast(&thread->cond);
+		UNLOCK_O;
+		pthread_join(thread->thread, NULL);
+		LOCK_O;
+	}
+
+	UNLOCK_O;
+}
+
 /*---------------------------------------------------------------------------*/
 bool output_start(struct thread_ctx_s *ctx) {
-	struct thread_param_s *param = calloc(sizeof(struct thread_param_s), 1);
+	struct output_thread_s *thread;
 	size_t slot;
 
 	LOCK_O;
@@ -107,81 +181,118 @@ bool output_start(struct thread_ctx_s *ctx) {
 		LOG_ERROR("[%p]: can't find a free thread, we should not be here!!! (s:%d)", ctx, ctx->output.state);
 		if (ctx->output.state < OUTPUT_RUNNING) {
 			LOG_ERROR("[%p]: terminating all threads immediately", ctx);
-			for (slot = 0; slot < ARRAY_COUNT(ctx->output_thread); slot++) {
-				ctx->output_thread[slot].running = false;
-				UNLOCK_O;
-				pthread_join(ctx->output_thread[slot].thread, NULL);
-				LOCK_O;
-			}
+			for (slot = 0; slot < ARRAY_COUNT(ctx->output_thread); slot++) _output_wait(ctx->output_thread + slot);
 			// restarting from slot 0
 			slot = 0;
 		} else {
+			UNLOCK_O;
 			return false;
 		}
 	}
 
 	// found something, now need to terminate it if it lingers
-	param->thread = ctx->output_thread + slot;
+	thread = ctx->output_thread + slot;
 
-	if (param->thread->running) {
-		param->thread->running = false;
-		UNLOCK_O;
-		LOG_INFO("[%p]: joining thread index:%d (slot:%d)", ctx, param->thread->index, param->thread->slot);
-		pthread_join(param->thread->thread, NULL);
-	} else {
-		UNLOCK_O;
-	}
+	if (thread->busy) LOG_INFO("[%p]: waiting thread index:%d (slot:%d)", ctx, thread->index, thread->slot);
+	_output_wait(thread);
+
+	thread->index = ctx->output.index;
+	thread->running = true;
+	thread->terminate = false;
+	thread->ctx = ctx;
 
-	// it's calloc
-	param->thread->index = ctx->output.index;
-	param->thread->running = true;
-	param->thread->terminate = false;
-	param->ctx = ctx;
+	UNLOCK_O;
 
 	// find a free port
 	ctx->output.port = sq_local_port;
-	for (int i = 0; i < 2 * MAX_PLAYER && param->thread->http <= 0; i++) {
+	for (int i = 0; i < 2 * MAX_PLAYER && thread->http <= 0; i++) {
 		struct in_addr host;
 		host.s_addr = INADDR_ANY;
-		param->thread->http = bind_socket(host, &ctx->output.port, SOCK_STREAM);
-		if (param->thread->http <= 0) ctx->output.port++;
+		thread->http = bind_socket(host, &ctx->output.port, SOCK_STREAM);
+		if (thread->http <= 0) ctx->output.port++;
 	}
 
+	LOCK_O;
+
 	// and listen to it
-	if (param->thread->http <= 0 || listen(param->thread->http, 1)) {
-		closesocket(param->thread->http);
-		param->thread->http = -1;
-		free(param);
+	if (thread->http <= 0 || listen(thread->http, 1)) {
+		closesocket(thread->http);
+		thread->http = -1;
+		thread->running = false;
+		UNLOCK_O;
 		return false;
 	}
 
-	LOG_INFO("[%p]: start thread index:%d (slot:%d)", ctx, param->thread->index, param->thread->slot);
-	pthread_create(&param->thread->thread, NULL, (void *(*)(void*)) &output_http_thread, param);
+	LOG_INFO("[%p]: start thread index:%d (slot:%d)", ctx, thread->index, thread->slot);
+
+	// worker is created once and then reused for every track
+	thread->busy = true;
+	if (!thread->active) {
+		thread->active = true;
+		pthread_create(&thread->thread, NULL, (void *(*)(void*)) &output_http_worker, thread);
+	} else {
+		pthread_cond_signal(&thread->cond);
+	}
+
+	UNLOCK_O;
 
 	return true;
 }
 
 /*---------------------------------------------------------------------------*/
-static void output_http_thread(struct thread_param_s *param) {
+static void output_http_worker(struct output_thread_s *thread) {
+	struct thread_ctx_s *ctx = thread->ctx;
+
+	LOCK_O;
+
+	while (thread->active) {
+		if (!thread->busy) {
+			pthread_cond_wait(&thread->cond, &ctx->outputbuf->mutex);
+			continue;
+		}
+		UNLOCK_O;
+		output_http_thread(thread);
+		LOCK_O;
+	}
+
+	_output_release(thread);
+	UNLOCK_O;
+
+	LOG_INFO("[%p]: worker slot:%d exited", ctx, thread->slot);
+}
+
+/*---------------------------------------------------------------------------*/
+static void output_http_thread(struct output_thread_s *thread) {
 	int sock = -1;
-	bool use_cache = false, acquired = false, http_ready = false, finished = false;
+	bool use_cache = false, acquired = false, http_ready = false, finished = false, idle = false;
 	fd_set rfds, wfds;
-	struct buffer __obuf, *obuf = &__obuf, backlog;
-	struct output_thread_s *thread = param->thread;
-	struct thread_ctx_s *ctx = param->ctx;
+	struct buffer *obuf = &thread->obuf, *backlog = &thread->backlog;
+	struct thread_ctx_s *ctx = thread->ctx;
 	unsigned drain_count = DRAIN_MAX;
 	u32_t start = gettime_ms();
 	FILE *store = NULL;
+	struct pacing_s pace = { 0 };
+	struct adapt_s adapt = { 0 };
 
 	enum cache_type_e cache_type = CACHE_INFINITE;
 	if (ctx->config.cache == HTTP_CACHE_MEMORY) cache_type = CACHE_RING;
 	else if (ctx->config.cache == HTTP_CACHE_DISK && ctx->output.duration) cache_type = CACHE_FILE;
-	cache_buffer *cache = cache_create(cache_type, 0);
 
-	buf_init(obuf, 128*1024);
-	buf_init(&backlog, max(ctx->output.icy.interval, MAX_BLOCK) + ICY_LEN_MAX + 2 + 16);
+	// memory caches are recycled but a file one can't be truncated
+	if (thread->cache && (thread->cache->type != cache_type || cache_type == CACHE_FILE)) {
+		cache_delete(thread->cache);
+		thread->cache = NULL;
+	}
+	if (thread->cache) thread->cache->flush(thread->cache);
+	else thread->cache = cache_create(cache_type, 0);
+	cache_buffer *cache = thread->cache;
 
-	free(param);
+	size_t backlog_size = max(ctx->output.icy.interval, MAX_BLOCK) + ICY_LEN_MAX + 2 + 16;
+	if (!obuf->buf) buf_init(obuf, 128*1024);
+	else buf_flush(obuf);
+	if (!backlog->buf) buf_init(backlog, backlog_size);
+	else if (backlog->size < backlog_size) _buf_resize(backlog, backlog_size);
+	else buf_flush(backlog);
 
 	if (*ctx->config.store_prefix) {
 		char name[STR_LEN];
@@ -203,7 +314,8 @@ static void output_http_thread(struct thread_param_s *param) {
 				sock = accept(thread->http, NULL, NULL);
 				set_nonblock(sock);
 				http_ready = finished = false;
-				buf_flush(&backlog);
+				buf_flush(backlog);
+				if (acquired) pacing_start(&pace, ctx, sock);
 				FD_ZERO(&wfds);
 				FD_ZERO(&rfds);
 			}
@@ -215,9 +327,19 @@ static void output_http_thread(struct thread_param_s *param) {
 
 		// don't need to loop too fast as we use a write fd
 		FD_SET(sock, &rfds);
+		if (idle) FD_SET(thread->http, &rfds);
 		bool res = true;
 		struct timeval timeout = { 0, TIMEOUT * 1000 };
-		int n = select(sock + 1, &rfds, &wfds, NULL, &timeout);
+		int n = select(max(sock, thread->http) + 1, &rfds, &wfds, NULL, &timeout);
+
+		// renderer opens a new connection instead of re-using the persistent one
+		if (idle && n > 0 && FD_ISSET(thread->http, &rfds)) {
+			LOG_INFO("[%p]: new connection, closing persistent one %d", ctx, sock);
+			closesocket(sock);
+			sock = -1;
+			idle = false;
+			continue;
+		}
 		
 		// need to wait till we have an initialized codec
 		if (!acquired && n > 0) {
@@ -233,12 +355,23 @@ static void output_http_thread(struct thread_param_s *param) {
 			_output_new_stream(obuf, store, ctx);
 			UNLOCK_O;
 
+			pacing_start(&pace, ctx, sock);
+
+			// when paced or live, renderer takes what it is given, can't measure it
+			adapt.done = pace.rate || !ctx->output.duration || !ctx->output.byte_rate;
+
 			LOG_INFO("[%p]: got codec, drain is %u (waited %u)", ctx, obuf->size, gettime_ms() - start);
 		}
 
 		// should be the HTTP headers
 		if (n > 0 && FD_ISSET(sock, &rfds)) {
-			http_ready = res = handle_http(ctx, cache, &use_cache, thread->lingering, thread->index, sock);
+			http_ready = res = handle_http(ctx, cache, &use_cache, thread->lingering, thread->index, sock, &idle);
+
+			// answered without a body on a persistent connection, wait for next request
+			if (idle) {
+				LOG_INFO("[%p]: keeping connection %d alive", ctx, sock);
+				continue;
+			}
 		}
 	
 		// something wrong happened or master connection closed
@@ -317,12 +450,16 @@ static void output_http_thread(struct thread_param_s *param) {
 		 * we wait for socket to be writable. But in theory, a writable socket does not guarantee
 		 * there is enough available space */
 
-		if (!FD_ISSET(sock, &wfds) && (use_cache || _buf_used(obuf) || _buf_used(&backlog))) {
+		if (!_buf_used(backlog) && (use_cache || _buf_used(obuf)) && pacing_hold(&pace, sock)) {
+			// far enough ahead of realtime, let select read or sleep
+			FD_ZERO(&wfds);
+		} else if (!FD_ISSET(sock, &wfds) && (use_cache || _buf_used(obuf) || _buf_used(backlog))) {
 			// we can't write but we have to, let's wait for select() 
 			FD_SET(sock, &wfds);
-		} else if (_buf_used(&backlog)) {
+		} else if (_buf_used(backlog)) {
 			// we have some backlog, give it priority
-			send_backlog(&backlog, sock, NULL, 0, 0);
+			ssize_t sent = send_backlog(backlog, sock, NULL, 0, 0);
+			if (!adapt.done) adapt_measure(&adapt, sent, use_cache || _buf_used(obuf) || _buf_used(backlog), ctx);
 		} else if (use_cache || _buf_used(obuf)) {
 			// only get what we can process (ignore result because all is always sent/backlog'd)
 			size_t chunk = ctx->output.icy.active ? ctx->output.icy.remain : MAX_BLOCK, bytes = chunk;
@@ -343,8 +480,13 @@ static void output_http_thread(struct thread_param_s *param) {
 			}
 
 			// some might be in backlog, but it will be sent later (we never really know anyway what send() does)
-			if (readp) send_with_icy(&ctx->output, &backlog, sock, readp, bytes, 0);
-			else FD_ZERO(&wfds);
+			if (readp) {
+				ssize_t sent = send_with_icy(&ctx->output, backlog, sock, readp, bytes, 0);
+				pace.tokens -= bytes;
+
+				// renderers should buffer as fast as they can at first, measure what they take
+				if (!adapt.done) adapt_measure(&adapt, sent, use_cache || _buf_used(obuf) || _buf_used(backlog), ctx);
+			} else FD_ZERO(&wfds);
 	
 			LOG_SDEBUG("[%p] sent %u bytes (total: %u)", ctx, bytes, cache->total);
 		} else if (finished) {
@@ -353,7 +495,7 @@ static void output_http_thread(struct thread_param_s *param) {
 			shutdown_socket(sock);
 			sock = -1;
 		} else if (!drain_count) {
-			if (ctx->output.chunked) send_backlog(&backlog, sock, "0\r\n\r\n", 5, 0);
+			if (ctx->output.chunked) send_backlog(backlog, sock, "0\r\n\r\n", 5, 0);
 			finished = true;
 			LOG_INFO("[%p]: full data sent (%zu)", ctx, cache->total);
 		} else {
@@ -366,10 +508,6 @@ static void output_http_thread(struct thread_param_s *param) {
 
 	LOG_INFO("[%p]: finishing thread index:%d (slot:%d) - sent %zu bytes", ctx, thread->index, thread->slot, cache->total);
 
-	buf_destroy(&backlog);
-	buf_destroy(obuf);
-	cache_delete(cache);
-
 	// in chunked mode, a full chunk might not have been sent (due to TCP)
 	if (sock != -1) shutdown_socket(sock);
 	shutdown_socket(thread->http);
@@ -386,10 +524,18 @@ static void output_http_thread(struct thread_param_s *param) {
 		ctx->output.completed = true;
 	}
 
-	if (thread->running) {
-		// if we self-terminate, nobody will join us so free resources now
-		pthread_detach(thread->thread);
-		thread->running = false;
+	// worker is idle again, let anybody waiting for it know
+	thread->running = false;
+	thread->busy = false;
+	pthread_cond_broadcast(&thread->cond);
+
+	// only one idle worker keeps its buffers for next track, others give them back
+	for (int i = 0; i < ARRAY_COUNT(ctx->output_thread); i++) {
+		struct output_thread_s *other = ctx->output_thread + i;
+		if (other == thread || other->busy || (!other->cache && !other->obuf.buf)) continue;
+		LOG_INFO("[%p]: releasing buffers of idle slot:%d", ctx, thread->slot);
+		_output_release(thread);
+		break;
 	}
 
 	UNLOCK_O;
@@ -397,61 +543,173 @@ static void output_http_thread(struct thread_param_s *param) {
 }
 
 /*----------------------------------------------------------------------------*/
-ssize_t send_backlog(struct buffer* backlog, int sock, const void* data, size_t bytes, int flags) {
-	// if there is no backlog buffer, it should be a blocking socket so just send
-	if (!backlog) return send(sock, data, bytes, flags);
+static void pacing_start(struct pacing_s *pace, struct thread_ctx_s *ctx, int sock) {
+	// nothing to do if not requested or if we don't know the bitrate
+	pace->rate = ((u64_t) ctx->output.byte_rate * PACING_MARGIN) / 100;
+	if (!ctx->config.pacing || !pace->rate) {
+		pace->rate = 0;
+		return;
+	}
 
-	// try to flush backlog if any
-	for (ssize_t sent = 0; _buf_used(backlog) && sent >= 0;) {
-		sent = send(sock, backlog->readp, _buf_cont_read(backlog), flags);
-		if (sent > 0) _buf_inc_readp(backlog, sent);
+	// renderer can first fill its buffer with the lead, then we go at (almost) realtime
+	pace->max = pace->tokens = (int64_t) pace->rate * ctx->config.pacing;
+	pace->last = gettime_ms();
+	pace->kernel = false;
+
+#if defined(TCP_NOTSENT_LOWAT)
+	// socket is writable only when it really needs data, not when its buffer has room
+	int lowat = 2 * MAX_BLOCK;
+	setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void*) &lowat, sizeof(lowat));
+#endif
+
+	LOG_INFO("[%p]: pacing at %u B/s after %d sec lead", ctx, pace->rate, ctx->config.pacing);
+}
+
+/*----------------------------------------------------------------------------*/
+static bool pacing_hold(struct pacing_s *pace, int sock) {
+	if (!pace->rate) return false;
+
+	u32_t now = gettime_ms();
+	pace->tokens = min(pace->tokens + ((int64_t) (now - pace->last) * pace->rate) / 1000, pace->max);
+	pace->last = now;
+
+	if (pace->tokens > 0) return false;
+
+#if defined(SO_MAX_PACING_RATE)
+	// once the lead has been sent, let the socket spread packets if it can
+	if (!pace->kernel) {
+		pace->kernel = true;
+		setsockopt(sock, SOL_SOCKET, SO_MAX_PACING_RATE, (void*) &pace->rate, sizeof(pace->rate));
+	}
+#endif
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static void adapt_measure(struct adapt_s *adapt, ssize_t sent, bool pending, struct thread_ctx_s *ctx) {
+	u32_t now = gettime_ms(), rate = ctx->output.byte_rate;
+
+	if (!adapt->first) adapt->first = adapt->last = now;
+	adapt->total += sent;
+
+	// time since last send only counts if data was already waiting for renderer
+	if (adapt->pending) {
+		adapt->elapsed += now - adapt->last;
+		adapt->slice += now - adapt->last;
+		adapt->bytes += sent;
+		adapt->slice_bytes += sent;
 	}
 
-	ssize_t sent = 0;
+	adapt->last = now;
+	adapt->pending = pending;
+
+	if (adapt->slice < ADAPT_SLICE) return;
+
+	// how much renderer has buffered ahead of realtime, negative when it's late
+	int64_t lead = (int64_t) adapt->total - (int64_t) (((u64_t) rate * (now - adapt->first)) / 1000);
+	u32_t took = ((u64_t) adapt->slice_bytes * 1000) / adapt->slice;
 
-	// try to send data if backlog is flushed
-	if (!_buf_used(backlog)) {
-		sent = send(sock, data, bytes, flags);
+	adapt->peak = max(adapt->peak, took);
+	adapt->slice = adapt->slice_bytes = 0;
+
+	/* Once its buffer is full, a renderer only reads at realtime, so what it takes from then on says 
+	 * nothing about the link. Stop as soon as it is ahead and slows down, what it took before is the 
+	 * best we know. Otherwise, it is only behind if it has been late for the whole window */
+	if (lead > 0 && took < (u64_t) rate * ADAPT_THROTTLE / 100) {
+		ctx->output.adapt.behind = false;
+	} else if (adapt->elapsed >= ADAPT_WINDOW) {
+		u32_t average = ((u64_t) adapt->bytes * 1000) / adapt->elapsed;
+		ctx->output.adapt.behind = lead < 0 && average < (u64_t) rate * ADAPT_DOWN / 100;
+	} else return;
+
+	ctx->output.adapt.capacity = adapt->peak;
+	adapt->done = true;
+
+	LOG_DEBUG("[%p]: renderer took up to %u B/s (stream %u B/s, lead %" PRId64 ", behind %d)", ctx, adapt->peak, rate, lead, ctx->output.adapt.behind);
+}
+
+/*----------------------------------------------------------------------------*/
+static ssize_t send_frames(struct buffer* backlog, int sock, struct frame_s *frames, int count, int flags) {
+	ssize_t sent = 0, flushed = 0;
+
+	// try to flush backlog if any
+	if (backlog) for (ssize_t n = 0; _buf_used(backlog) && n >= 0;) {
+		n = send(sock, backlog->readp, _buf_cont_read(backlog), flags);
+		if (n > 0) {
+			_buf_inc_readp(backlog, n);
+			flushed += n;
+		}
+	}
+
+	// try to send all frames at once if backlog is flushed (no backlog means blocking socket)
+	if (!backlog || !_buf_used(backlog)) {
+#if WIN
+		for (int i = 0; i < count; i++) {
+			ssize_t n = send(sock, frames[i].data, frames[i].len, flags);
+			if (n > 0) sent += n;
+			if ((size_t) n != frames[i].len) break;
+		}
+#else
+		struct iovec iov[MAX_FRAMES];
+		struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+		for (int i = 0; i < count; i++) {
+			iov[i].iov_base = (void*) frames[i].data;
+			iov[i].iov_len = frames[i].len;
+		}
+		sent = sendmsg(sock, &msg, flags);
 		if (sent < 0) sent = 0;
+#endif
 	}
 
-	// store what we have not sent
-	_buf_write(backlog, (u8_t*) data + sent, bytes - sent);
+	if (!backlog) return sent;
+
+	// we always accept the whole block, store what we have not sent, skipping what has been
+	flushed += sent;
+	for (int i = 0; i < count; i++) {
+		size_t skip = min((size_t) sent, frames[i].len);
+		sent -= skip;
+		_buf_write(backlog, (u8_t*) frames[i].data + skip, frames[i].len - skip);
+	}
 
-	// we always accept the whole block
-	return bytes;
+	// but only report what the socket actually took
+	return flushed;
 }
 
 /*----------------------------------------------------------------------------*/
-static ssize_t send_chunked(bool chunked, struct buffer *backlog, int sock, const void *data, size_t bytes, int flags) {
-	if (!chunked) return send_backlog(backlog, sock, data, bytes, flags);
-	
-	char chunk[16];
+static ssize_t send_backlog(struct buffer* backlog, int sock, const void* data, size_t bytes, int flags) {
+	struct frame_s frame = { data, bytes };
+	return send_frames(backlog, sock, &frame, 1, flags);
+}
+
+/*----------------------------------------------------------------------------*/
+static int add_chunked(struct frame_s *frames, char *chunk, bool chunked, const void *data, size_t bytes) {
+	frames[chunked ? 1 : 0] = (struct frame_s) { data, bytes };
+	if (!chunked) return 1;
+
 	itoa(bytes, chunk, 16);
 	strcat(chunk, "\r\n");
 
-	send_backlog(backlog, sock, chunk, strlen(chunk), flags);
-	ssize_t sent = send_backlog(backlog, sock, data, bytes, flags);
-	send_backlog(backlog, sock, "\r\n", 2, flags);
+	frames[0] = (struct frame_s) { chunk, strlen(chunk) };
+	frames[2] = (struct frame_s) { "\r\n", 2 };
 
-	return sent;
+	return 3;
 }
 
 /*----------------------------------------------------------------------------*/
 static ssize_t send_with_icy(struct outputstate* out, struct buffer *backlog, int sock, const void *data, size_t bytes, int flags) {
-	// first send remaining data bytes wich are always smaller or equal to icy.remain
-	bytes = send_chunked(out->chunked, backlog, sock, data, bytes, flags);
-
-	// ICY not active, just send
-	if (!out->icy.active) return bytes;
+	struct frame_s frames[MAX_FRAMES];
+	char chunk[2][16], buffer[ICY_LEN_MAX];
 
-	out->icy.remain -= bytes;
-	LOG_DEBUG("[%p]: ICY remains %zu (sending %zu)", out, out->icy.remain, bytes);
+	// first add remaining data bytes wich are always smaller or equal to icy.remain
+	int count = add_chunked(frames, chunk[0], out->chunked, data, bytes);
 
-	// ICY is active
-	if (!out->icy.remain) {
+	// ICY is active and we have reached the interval
+	if (out->icy.active && !(out->icy.remain -= bytes)) {
 		int len_16 = 0;
-		char* buffer = calloc(ICY_LEN_MAX, 1);
+
+		// length byte only when there is no update
+		buffer[0] = 0;
 
 		if (out->icy.updated) {
 			char *format = (out->icy.artwork && *out->icy.artwork) ?
@@ -461,6 +719,7 @@ static ssize_t send_with_icy(struct outputstate* out, struct buffer *backlog, in
 			int len = snprintf(buffer, ICY_LEN_MAX, format,
 							 out->icy.artist, *out->icy.artist ? " - " : "",
 							 out->icy.title, out->icy.artwork) - 1;
+			if (len > ICY_LEN_MAX - 1) len = ICY_LEN_MAX - 1;
 
 			len_16 = (len + 15) / 16;
 			memset(buffer + len + 1, 0, len_16 * 16 - len);
@@ -469,22 +728,26 @@ static ssize_t send_with_icy(struct outputstate* out, struct buffer *backlog, in
 			LOG_INFO("[%p]: ICY update of %d bytes (%d blocks)\n\t%s\n\t%s\n\t%s", out, len, len_16, out->icy.artist, out->icy.title, out->icy.artwork);
 		}
 
-		send_chunked(out->chunked, backlog, sock, buffer, len_16 * 16 + 1, flags);
-		free(buffer);
+		count += add_chunked(frames + count, chunk[1], out->chunked, buffer, len_16 * 16 + 1);
 
 		out->icy.remain = out->icy.interval;
 		out->icy.updated = false;
 	}
 
-	return bytes;
+	if (out->icy.active) LOG_DEBUG("[%p]: ICY remains %zu (sending %zu)", out, out->icy.remain, bytes);
+
+	// whole block (data, chunk framing and metadata) in one go
+	return send_frames(backlog, sock, frames, count, flags);
 }
 
 /*----------------------------------------------------------------------------*/
-static bool handle_http(struct thread_ctx_s *ctx, cache_buffer* cache, bool *use_cache, bool lingering, int index, int sock) {
+static bool handle_http(struct thread_ctx_s *ctx, cache_buffer* cache, bool *use_cache, bool lingering, int index, int sock, bool *keep_alive) {
 	char* body = NULL, * request = NULL, * p = NULL;
 	key_data_t headers[64], resp[16] = { { NULL, NULL } };
 	int len, id;
 
+	*keep_alive = false;
+
 	if (!http_parse_simple(sock, &request, headers, &body, &len)) {
 		LOG_WARN("[%p]: http parsing error %s", ctx, request);
 		NFREE(body);
@@ -494,9 +757,10 @@ static bool handle_http(struct thread_ctx_s *ctx, cache_buffer* cache, bool *use
 	}
 
 	// we could always claim to be 1.1 though
-	char* head = NULL, *response = NULL;
+	char* head = NULL, *response = NULL, status[64];
 	enum { ANY, SONOS, CHROMECAST } type;
 	bool send_body = strstr(request, "HEAD") == NULL;
+	bool persistent = strstr(request, "HTTP/1.1") && !((p = kd_lookup(headers, "Connection")) != NULL && strcasestr(p, "close"));
 	
 	LOG_INFO("[%p]: received %s", ctx, request);
 	sscanf(request, "%*[^/]/" BRIDGE_URL "%d", &id);
@@ -616,7 +880,6 @@ static bool handle_http(struct thread_ctx_s *ctx, cache_buffer* cache, bool *use
 		kd_add(resp, "Server", "squeezebox-bridge");
 		kd_add(resp, "Accept-Ranges", "bytes");
 		kd_add(resp, "Content-Type", ctx->output.mimetype);
-		kd_add(resp, "Connection", "close");
 
 		if (send_body) {
 			// size might have been updated, last chance to update chunked mode
@@ -631,6 +894,19 @@ static bool handle_http(struct thread_ctx_s *ctx, cache_buffer* cache, bool *use
 
 	// unless instructed otherwise use a 200 with the correct HTTP version
 	if (!head) head = ctx->output.chunked ? "HTTP/1.1 200 OK" : "HTTP/1.0 200 OK";
+
+	/* a body ends only when we close the connection, so only bodyless responses (HEAD, probes
+	 * and errors) can keep it for the next request. Then they must use 1.1 and say they're empty */
+	*keep_alive = persistent && !send_body;
+	if (*keep_alive) {
+		snprintf(status, sizeof(status), "%s", head);
+		status[7] = '1';
+		head = status;
+		if (strstr(request, "HEAD") == NULL) kd_add(resp, "Content-Length", "0");
+		kd_add(resp, "Connection", "keep-alive");
+	} else {
+		kd_add(resp, "Connection", "close");
+	}
 	response = http_send(sock, head, resp);
 	LOG_INFO("[%p]: responding:\n%s", ctx, response);
 
@@ -49,8 +49,88 @@ static log_level *loglevel = &decode_loglevel;
 
 struct pcm {
 	unsigned bytes_per_frame;
+	bool native;
 };
 
+/*---------------------------------------------------------------------------*/
+static bool pcm_native_format(struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	u8_t sample_size = out->encode.sample_size;
+
+	// same rule than output when size is not forced
+	if (!sample_size) sample_size = (ctx->config.L24_format == L24_TRUNC16 && out->sample_size == 24) ? 16 : out->sample_size;
+
+	// any gain, fade or format change needs the full pipeline
+	return out->codec == 'p' && out->encode.mode == ENCODE_PCM && !out->encode.flow &&
+		   out->fade_mode == FADE_NONE && !out->next_replay_gain &&
+		   (out->sample_size == 16 || (out->sample_size == 24 && ctx->config.L24_format != L24_PACKED_LPCM)) &&
+		   sample_size == out->sample_size && out->sample_rate && (out->in_endian == 0 || out->in_endian == 1) &&
+		   (!out->encode.sample_rate || out->encode.sample_rate == out->sample_rate) &&
+		   (out->channels == 1 || out->channels == 2) &&
+		   (!out->encode.channels || out->encode.channels == out->channels);
+}
+
+/*---------------------------------------------------------------------------*/
+static bool pcm_native(struct thread_ctx_s *ctx) {
+	IF_PROCESS(
+		return false;
+	);
+
+	return pcm_native_format(ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+size_t pcm_outputbuf_size(struct thread_ctx_s *ctx) {
+	size_t size = ctx->config.outputbuf_size;
+
+	if (!pcm_native_format(ctx)) return size;
+
+	// native frames are smaller, so same duration fits in a smaller outputbuf (keep it frame aligned)
+	size = (size / BYTES_PER_FRAME) * (ctx->output.sample_size * ctx->output.channels / 8);
+	return size - size % (3 * BYTES_PER_FRAME);
+}
+
+/*---------------------------------------------------------------------------*/
+static void pcm_swap(u8_t *dst, u8_t *src, size_t count, u8_t bytes) {
+	u8_t b;
+
+	if (bytes == 2) for (; count--; src += 2, dst += 2) {
+		b = src[0]; dst[0] = src[1]; dst[1] = b;
+	} else for (; count--; src += 3, dst += 3) {
+		b = src[0]; dst[0] = src[2]; dst[1] = src[1]; dst[2] = b;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static decode_state pcm_native_decode(struct pcm *p, struct thread_ctx_s *ctx) {
+	u8_t *iptr = ctx->streambuf->readp, ibuf[BYTES_PER_FRAME];
+	size_t bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	size_t out = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf));
+	bool swap = ctx->output.in_endian != ctx->output.out_endian;
+	frames_t frames = min(bytes, out) / p->bytes_per_frame;
+
+	frames = min(frames, MAX_DECODE_FRAMES);
+
+	if (frames) {
+		if (swap) pcm_swap(ctx->outputbuf->writep, iptr, frames * ctx->output.channels, ctx->output.sample_size / 8);
+		else memcpy(ctx->outputbuf->writep, iptr, frames * p->bytes_per_frame);
+		_buf_inc_writep(ctx->outputbuf, frames * p->bytes_per_frame);
+		_buf_inc_readp(ctx->streambuf, frames * p->bytes_per_frame);
+	} else if (_buf_used(ctx->streambuf) >= p->bytes_per_frame && _buf_space(ctx->outputbuf) >= p->bytes_per_frame) {
+		// one of the buffers wraps within the frame
+		_buf_read(ibuf, ctx->streambuf, p->bytes_per_frame);
+		if (swap) pcm_swap(ibuf, ibuf, ctx->output.channels, ctx->output.sample_size / 8);
+		_buf_write(ctx->outputbuf, ibuf, p->bytes_per_frame);
+		frames = 1;
+	}
+
+	LOG_SDEBUG("[%p]: copied %u frames", ctx, frames);
+
+	ctx->decode.frames += frames;
+
+	return DECODE_RUNNING;
+}
+
 /*---------------------------------------------------------------------------*/
 static unsigned check_header(struct thread_ctx_s *ctx) {
 	u8_t *ptr = ctx->streambuf->readp;
@@ -121,11 +201,27 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 	struct pcm *p = ctx->decode.handle;
 	u8_t *iptr, ibuf[BYTES_PER_FRAME];
 	u32_t *optr = NULL;
+	static u8_t silence[BYTES_PER_FRAME];
 
 	LOCK_S;
 	LOCK_O_direct;
 
 	if (ctx->stream.state <= DISCONNECT && _buf_used(ctx->streambuf) < p->bytes_per_frame) {
+		// native frames do not align outputbuf, pad with silence for whatever comes next
+		if (p->native) {
+			size_t pad_bytes, offset = (ctx->outputbuf->writep - ctx->outputbuf->buf) % BYTES_PER_FRAME;
+
+			for (pad_bytes = 0; (offset + pad_bytes) % BYTES_PER_FRAME; pad_bytes += p->bytes_per_frame);
+
+			// wait for output to make room, can't write partial frames
+			if (_buf_space(ctx->outputbuf) < pad_bytes) {
+				UNLOCK_O_direct;
+				UNLOCK_S;
+				return DECODE_RUNNING;
+			}
+
+			for (; pad_bytes; pad_bytes -= p->bytes_per_frame) _buf_write(ctx->outputbuf, silence, p->bytes_per_frame);
+		}
 		UNLOCK_O_direct;
 		UNLOCK_S;
 		return DECODE_COMPLETE;
@@ -147,10 +243,19 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 
 		ctx->output.direct_sample_rate = ctx->output.sample_rate;
 		ctx->output.sample_rate = decode_newstream(ctx->output.sample_rate, ctx->output.supported_rates, ctx);
+		p->bytes_per_frame = (ctx->output.sample_size * ctx->output.channels) / 8;
+		p->native = ctx->output.encode.native = pcm_native(ctx);
+
+		// outputbuf is sized at track start, only fix it if header or processing changed the guess
+		if (!_buf_used(ctx->outputbuf)) {
+			_buf_resize(ctx->outputbuf, p->native ? pcm_outputbuf_size(ctx) : ctx->config.outputbuf_size);
+		}
+
+		if (p->native) LOG_INFO("[%p]: pcm sent in native format (outputbuf %zu bytes)", ctx, ctx->outputbuf->size);
+
 		ctx->output.track_start = ctx->outputbuf->writep;
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
-		p->bytes_per_frame = (ctx->output.sample_size * ctx->output.channels) / 8;
 
 		UNLOCK_O_not_direct;
 
@@ -159,6 +264,13 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 		);
 	}
 
+	if (p->native) {
+		decode_state state = pcm_native_decode(p, ctx);
+		UNLOCK_O_direct;
+		UNLOCK_S;
+		return state;
+	}
+
 	IF_DIRECT(
 		optr = (u32_t*) ctx->outputbuf->writep;
 	);
@@ -316,6 +428,7 @@ static void pcm_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t en
 	struct pcm *p = ctx->decode.handle;
 	if (!p)	p = ctx->decode.handle = malloc(sizeof(struct pcm));
 	p->bytes_per_frame = BYTES_PER_FRAME;
+	p->native = false;
 }
 
 /*---------------------------------------------------------------------------*/
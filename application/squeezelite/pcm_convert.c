@@ -0,0 +1,52 @@
+/*
+ *  Conversion of decoders output into outputbuf frames
+ *
+ *	(c) Philippe, philippe_44@outlook.com
+ *
+ *  See LICENSE
+ */
+
+#include "pcm_convert.h"
+
+/*---------------------------------------------------------------------------*/
+/* Conversion of decoders output into outputbuf frames (s32, 2 channels). The
+ * loops are branchless and source/destination never overlap so that compiler
+ * can vectorize them. For mono, use the same pointer for left and right	 */
+/*---------------------------------------------------------------------------*/
+void pcm_from_float(int32_t *dst, float *left, float *right, size_t frames, int depth) {
+	float scale = 1 << (depth - 1), hi = (1 << (depth - 1)) - 1, lo = -(1 << (depth - 1));
+	int shift = 32 - depth;
+
+	// clamp before conversion, same result than clamping the truncated integer
+	for (size_t i = 0; i < frames; i++) {
+		float l = left[i] * scale + 0.5f, r = right[i] * scale + 0.5f;
+		l = l > hi ? hi : l < lo ? lo : l;
+		r = r > hi ? hi : r < lo ? lo : r;
+		dst[2*i] = (int32_t) l * (1 << shift);
+		dst[2*i + 1] = (int32_t) r * (1 << shift);
+	}
+}
+
+void pcm_from_fixed(int32_t *dst, int32_t *left, int32_t *right, size_t frames, int fracbits) {
+	int32_t one = 1 << fracbits, round = 1 << (fracbits - 24);
+	int shift = fracbits + 1 - 24;
+
+	// round to 24 bits and saturate
+	for (size_t i = 0; i < frames; i++) {
+		int32_t l = left[i] + round, r = right[i] + round;
+		l = l >= one ? one - 1 : l < -one ? -one : l;
+		r = r >= one ? one - 1 : r < -one ? -one : r;
+		dst[2*i] = (l >> shift) * (1 << 8);
+		dst[2*i + 1] = (r >> shift) * (1 << 8);
+	}
+}
+
+void pcm_from_s32(int32_t *dst, int32_t *src, size_t frames, int channels, int shift) {
+	if (channels == 2) for (size_t i = 0; i < frames * 2; i++) dst[i] = src[i] * (1 << shift);
+	else for (size_t i = 0; i < frames; i++) dst[2*i] = dst[2*i + 1] = src[i] * (1 << shift);
+}
+
+void pcm_from_s16(int32_t *dst, int16_t *src, size_t frames, int channels) {
+	if (channels == 2) for (size_t i = 0; i < frames * 2; i++) dst[i] = src[i] * (1 << 16);
+	else for (size_t i = 0; i < frames; i++) dst[2*i] = dst[2*i + 1] = src[i] * (1 << 16);
+}
@@ -0,0 +1,17 @@
+/*
+ *  Conversion of decoders output into outputbuf frames
+ *
+ *	(c) Philippe, philippe_44@outlook.com
+ *
+ *  See LICENSE
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+void	pcm_from_float(int32_t *dst, float *left, float *right, size_t frames, int depth);
+void	pcm_from_fixed(int32_t *dst, int32_t *left, int32_t *right, size_t frames, int fracbits);
+void	pcm_from_s32(int32_t *dst, int32_t *src, size_t frames, int channels, int shift);
+void	pcm_from_s16(int32_t *dst, int16_t *src, size_t frames, int channels);
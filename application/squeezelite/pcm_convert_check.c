@@ -0,0 +1,174 @@
+/*
+ *  Bit-exactness check of pcm_convert against the per-decoder code it replaced
+ *
+ *	(c) Philippe, philippe_44@outlook.com
+ *
+ *  See LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm_convert.h"
+
+#define MAX_FRAMES		1027		// odd on purpose, so tails of vectorized loops are exercised
+#define RANDOM_RUNS		1000
+#define VORBIS_DEPTH	24
+#define MAD_FRACBITS	28
+
+static int errors;
+
+/*---------------------------------------------------------------------------*/
+/* reference code, as it was in vorbis.c, mad.c, faad.c and alac.c			 */
+/*---------------------------------------------------------------------------*/
+static int32_t clip15f(float x) {
+	int32_t ret = x * (1 << (VORBIS_DEPTH-1)) + 0.5f;
+	if (ret > (1 << (VORBIS_DEPTH-1)) - 1) ret = (1 << (VORBIS_DEPTH-1)) - 1;
+	else if (ret < -(1 << (VORBIS_DEPTH-1))) ret = -(1 << (VORBIS_DEPTH-1));
+	return ret;
+}
+
+static uint32_t scale(int32_t sample) {
+	sample += (1L << (MAD_FRACBITS - 24));
+
+	if (sample >= (1L << MAD_FRACBITS))
+		sample = (1L << MAD_FRACBITS) - 1;
+	else if (sample < -(1L << MAD_FRACBITS))
+		sample = -(1L << MAD_FRACBITS);
+
+	return (int32_t)((sample >> (MAD_FRACBITS + 1 - 24)) << 8);
+}
+
+static void ref_float(int32_t *optr, float *iptr_l, float *iptr_r, size_t count) {
+	while (count--) {
+		*optr++ = clip15f(*iptr_l++) << (32 - VORBIS_DEPTH);
+		*optr++ = clip15f(*iptr_r++) << (32 - VORBIS_DEPTH);
+	}
+}
+
+static void ref_fixed(int32_t *optr, int32_t *iptrl, int32_t *iptrr, size_t count) {
+	while (count--) {
+		*optr++ = scale(*iptrl++);
+		*optr++ = scale(*iptrr++);
+	}
+}
+
+static void ref_s32(int32_t *optr, int32_t *iptr, size_t count, int channels) {
+	if (channels == 2) {
+		while (count--) {
+			*optr++ = *iptr++ << 8;
+			*optr++ = *iptr++ << 8;
+		}
+	} else {
+		while (count--) {
+			*optr++ = *iptr << 8;
+			*optr++ = *iptr++ << 8;
+		}
+	}
+}
+
+static void ref_s16(int32_t *optr, uint8_t *iptr, size_t count) {
+	// alac read 32 bits at a 16 bits offset and kept the low half (little endian)
+	while (count--) {
+		uint32_t l, r;
+		memcpy(&l, iptr, 4);
+		memcpy(&r, iptr + 2, 4);
+		*optr++ = l << 16;
+		*optr++ = r << 16;
+		iptr += 4;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void compare(const char *name, int32_t *ref, int32_t *dst, size_t frames) {
+	for (size_t i = 0; i < frames * 2; i++) {
+		if (ref[i] == dst[i]) continue;
+		printf("%s: frame %zu of %zu, %d instead of %d\n", name, i / 2, frames, dst[i], ref[i]);
+		errors++;
+		return;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static float random_float(void) {
+	// mostly in range, some beyond full scale on both sides
+	return ((float) rand() / RAND_MAX) * 3.0f - 1.5f;
+}
+
+/*---------------------------------------------------------------------------*/
+static int32_t random_fixed(void) {
+	// mad has 3 integer bits, so a full int32 is +/-8.0, keep room for rounding
+	int32_t one = 1 << MAD_FRACBITS;
+	return (int32_t) (((int64_t) rand() << 16 ^ rand()) % (8LL * one - 16)) * (rand() & 1 ? 1 : -1);
+}
+
+/*---------------------------------------------------------------------------*/
+int main(void) {
+	static float fl[MAX_FRAMES + 1], fr[MAX_FRAMES + 1];
+	static int32_t xl[MAX_FRAMES + 1], xr[MAX_FRAMES + 1], s32[MAX_FRAMES * 2 + 1];
+	static int16_t s16[MAX_FRAMES * 2 + 2];
+	static int32_t ref[MAX_FRAMES * 2], dst[MAX_FRAMES * 2];
+	int32_t one = 1 << MAD_FRACBITS;
+
+	const float float_edges[] = { 0.0f, -0.0f, 1.0f, -1.0f, 1.0f - 1.0f / (1 << 23), -1.0f + 1.0f / (1 << 23),
+								  0.5f / (1 << 23), -0.5f / (1 << 23), 1.5f, -1.5f, 2.0f, -2.0f, 1e-9f, -1e-9f };
+	const int32_t fixed_edges[] = { 0, 1, -1, one, -one, one - 1, -one + 1, one + 1, -one - 1,
+									(1 << (MAD_FRACBITS - 24)) - 1, -(1 << (MAD_FRACBITS - 24)),
+									INT32_MAX - 16, INT32_MIN };
+	const int32_t s32_edges[] = { 0, 1, -1, (1 << 23) - 1, -(1 << 23) };
+	const int16_t s16_edges[] = { 0, 1, -1, INT16_MAX, INT16_MIN };
+
+	srand(1);
+
+	for (int run = 0; run < RANDOM_RUNS; run++) {
+		// first run is edge values only, then random frame counts (odd ones included)
+		size_t frames = run ? 1 + rand() % MAX_FRAMES : MAX_FRAMES;
+
+		for (size_t i = 0; i < frames; i++) {
+			if (!run) {
+				fl[i] = float_edges[i % (sizeof(float_edges) / sizeof(float))];
+				fr[i] = float_edges[(i + 1) % (sizeof(float_edges) / sizeof(float))];
+				xl[i] = fixed_edges[i % (sizeof(fixed_edges) / sizeof(int32_t))];
+				xr[i] = fixed_edges[(i + 1) % (sizeof(fixed_edges) / sizeof(int32_t))];
+			} else {
+				fl[i] = random_float();
+				fr[i] = random_float();
+				xl[i] = random_fixed();
+				xr[i] = random_fixed();
+			}
+		}
+
+		for (size_t i = 0; i < frames * 2; i++) {
+			s32[i] = run ? (rand() % (1 << 24)) - (1 << 23) : s32_edges[i % (sizeof(s32_edges) / sizeof(int32_t))];
+			s16[i] = run ? (int16_t) rand() : s16_edges[i % (sizeof(s16_edges) / sizeof(int16_t))];
+		}
+
+		ref_float(ref, fl, fr, frames);
+		pcm_from_float(dst, fl, fr, frames, VORBIS_DEPTH);
+		compare("float stereo", ref, dst, frames);
+
+		ref_float(ref, fl, fl, frames);
+		pcm_from_float(dst, fl, fl, frames, VORBIS_DEPTH);
+		compare("float mono", ref, dst, frames);
+
+		ref_fixed(ref, xl, xr, frames);
+		pcm_from_fixed(dst, xl, xr, frames, MAD_FRACBITS);
+		compare("fixed", ref, dst, frames);
+
+		ref_s32(ref, s32, frames, 2);
+		pcm_from_s32(dst, s32, frames, 2, 8);
+		compare("s32 stereo", ref, dst, frames);
+
+		ref_s32(ref, s32, frames, 1);
+		pcm_from_s32(dst, s32, frames, 1, 8);
+		compare("s32 mono", ref, dst, frames);
+
+		ref_s16(ref, (uint8_t*) s16, frames);
+		pcm_from_s16(dst, s16, frames, 2);
+		compare("s16 stereo", ref, dst, frames);
+	}
+
+	printf("pcm_convert: %s (%d runs)\n", errors ? "FAILED" : "bit-exact", RANDOM_RUNS);
+	return errors ? 1 : 0;
+}
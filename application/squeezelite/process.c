@@ -45,72 +45,111 @@ static log_level 	*loglevel = &decode_loglevel;
 #endif
 
 
-// transfer all processed frames to the output buf
-static void _write_samples(struct thread_ctx_s *ctx) {
-	size_t frames = ctx->process.out_frames;
-	u16_t *iptr   = (u16_t *) ctx->process.outbuf;
-	unsigned cnt  = 10;
+// transfer processed frames to the output buf as far as there is space, what
+// does not fit is kept for later so that decode is held back (back-pressure)
+static bool _write_samples(struct thread_ctx_s *ctx) {
+	struct processstate *p = &ctx->process;
 
 	LOCK_O;
 
-	while (frames > 0) {
+	while (p->out_pos < p->out_frames) {
 
 		frames_t f = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
-		u16_t *optr = (u16_t *)ctx->outputbuf->writep;
 
-		if (f > 0) {
+		if (!f) break;
 
-			f = min(f, frames);
+		f = min(f, p->out_frames - p->out_pos);
 
-			memcpy(optr, iptr, f * BYTES_PER_FRAME);
+		memcpy(ctx->outputbuf->writep, p->outbuf + p->out_pos * BYTES_PER_FRAME, f * BYTES_PER_FRAME);
 
-			frames -= f;
+		_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
+		p->out_pos += f;
+	}
 
-			_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
-			iptr += f * BYTES_PER_FRAME / sizeof(*iptr);
+	UNLOCK_O;
 
-		} else if (cnt--) {
+	if (p->out_pos < p->out_frames) {
+		LOG_SDEBUG("[%p]: outputbuf full, holding %u frames", ctx, p->out_frames - p->out_pos);
+		return false;
+	}
 
-			// there should normally be space in the output buffer, but may need to wait during drain phase
-			UNLOCK_O;
-			usleep(10000);
-			LOCK_O;
+	p->out_frames = p->out_pos = 0;
 
-		} else {
+	return true;
+}
 
-			// bail out if no space found after 100ms to avoid locking
-			LOG_ERROR("[%p]: unable to get space in output buffer", ctx);
-			UNLOCK_O;
-			return;
-		}
-	}
+// one processing pass, straight into outputbuf when it has enough contiguous
+// room, otherwise (wrap point) through the interim buffer
+static bool _process(struct thread_ctx_s *ctx, bool drain) {
+	frames_t f;
+	u8_t *writep;
+	bool done = true;
 
+	LOCK_O;
+	f = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
+	writep = ctx->outputbuf->writep;
 	UNLOCK_O;
+
+	if (f >= ctx->process.max_out_frames) {
+
+		/*
+		Resampling can be long so don't hold output mutex meanwhile. Only decode
+		thread moves writep and flush needs decode mutex, so that region of
+		outputbuf remains ours until writep is moved
+		*/
+		if (drain) done = DRAIN_FUNC(ctx, writep, f);
+		else SAMPLES_FUNC(ctx, writep, f);
+
+		LOCK_O;
+		_buf_inc_writep(ctx->outputbuf, ctx->process.out_frames * BYTES_PER_FRAME);
+		UNLOCK_O;
+
+		ctx->process.out_frames = 0;
+
+		return done;
+	}
+
+	if (drain) done = DRAIN_FUNC(ctx, ctx->process.outbuf, ctx->process.max_out_frames);
+	else SAMPLES_FUNC(ctx, ctx->process.outbuf, ctx->process.max_out_frames);
+
+	ctx->process.out_pos = 0;
+	_write_samples(ctx);
+
+	return done;
 }
 
 // process samples - called with decode mutex set
 void process_samples(struct thread_ctx_s *ctx) {
 
-	SAMPLES_FUNC(ctx);
-
+	// decode only runs when outputbuf can take max_out_frames, so leftovers always fit
 	_write_samples(ctx);
 
+	_process(ctx, false);
+
 	ctx->process.in_frames = 0;
 }
 
-// drain at end of track - called with decode mutex set
-void process_drain(struct thread_ctx_s *ctx) {
-	bool done;
+// drain at end of track - called with decode mutex set, returns false when
+// outputbuf is full and drain has to be resumed once it has room again
+bool process_drain(struct thread_ctx_s *ctx) {
+	bool done = false;
+
+	ctx->process.draining = true;
+
+	if (!_write_samples(ctx)) return false;
 
-	do {
+	while (!done) {
 
-		done = DRAIN_FUNC(ctx);
+		done = _process(ctx, true);
 
-		_write_samples(ctx);
+		if (ctx->process.out_frames) return false;
+	}
 
-	} while (!done);
+	ctx->process.draining = false;
 
 	LOG_DEBUG("[%p]: processing track complete - frames in: %lu out: %lu", ctx, ctx->process.total_in, ctx->process.total_out);
+
+	return true;
 }
 
 // new stream - called with decode mutex set
@@ -126,7 +165,8 @@ unsigned process_newstream(bool *direct, unsigned raw_sample_rate, int supported
 
 		unsigned max_in_frames, max_out_frames;
 
-		ctx->process.in_frames = ctx->process.out_frames = 0;
+		ctx->process.in_frames = ctx->process.out_frames = ctx->process.out_pos = 0;
+		ctx->process.draining = false;
 		ctx->process.total_in = ctx->process.total_out = 0;
 
 		max_in_frames = ctx->codec->min_space / BYTES_PER_FRAME ;
@@ -171,7 +211,8 @@ void process_flush(struct thread_ctx_s *ctx) {
 
 	FLUSH_FUNC(ctx);
 
-	ctx->process.in_frames = 0;
+	ctx->process.in_frames = ctx->process.out_frames = ctx->process.out_pos = 0;
+	ctx->process.draining = false;
 }
 
 // init - called with no mutex
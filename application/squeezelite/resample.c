@@ -28,6 +28,8 @@
 #include <math.h>
 #include <soxr.h>
 
+#define MAX_RESAMPLE_THREADS	16
+
 extern log_level 	decode_loglevel;
 static log_level 	*loglevel = &decode_loglevel;
 
@@ -45,6 +47,7 @@ struct  {
 	soxr_t (* soxr_create)(double, double, unsigned, soxr_error_t *,
 						   soxr_io_spec_t const *, soxr_quality_spec_t const *, soxr_runtime_spec_t const *);
 	void (* soxr_delete)(soxr_t);
+	soxr_error_t (* soxr_clear)(soxr_t);
 	soxr_error_t (* soxr_process)(soxr_t, soxr_in_t, size_t, size_t *, soxr_out_t, size_t olen, size_t *);
 	size_t *(* soxr_num_clips)(soxr_t);
 #if RESAMPLE_MP
@@ -56,6 +59,8 @@ struct  {
 
 struct soxr {
 	soxr_t resampler;
+	unsigned in_rate, out_rate;
+	bool drained;
 	size_t old_clips;
 	unsigned long q_recipe;
 	unsigned long q_flags;
@@ -66,6 +71,9 @@ struct soxr {
 	double scale;
 	bool max_rate;
 	bool exception;
+#if RESAMPLE_MP
+	unsigned threads;
+#endif
 };
 
 #if LINKALL
@@ -74,13 +82,13 @@ struct soxr {
 #define SOXR(h, fn, ...) (h)->soxr_##fn(__VA_ARGS__)
 #endif
 
-void resample_samples(struct thread_ctx_s *ctx) {
+void resample_samples(struct thread_ctx_s *ctx, u8_t *out, frames_t space) {
 	struct soxr *r = ctx->decode.process_handle;
 	size_t idone, odone;
 	size_t clip_cnt;
 
 	soxr_error_t error =
-		SOXR(&gr, process, r->resampler, ctx->process.inbuf, ctx->process.in_frames, &idone, ctx->process.outbuf, ctx->process.max_out_frames, &odone);
+		SOXR(&gr, process, r->resampler, ctx->process.inbuf, ctx->process.in_frames, &idone, out, space, &odone);
 	if (error) {
 		LOG_INFO("[%p]: soxr_process error: %s", ctx, soxr_strerror(error));
 		return;
@@ -89,7 +97,7 @@ void resample_samples(struct thread_ctx_s *ctx) {
 	if (idone != ctx->process.in_frames) {
 		// should not get here if buffers are big enough...
 		LOG_ERROR("[%p]: should not get here - partial sox process: %u of %u processed %u of %u out",
-				  ctx, (unsigned)idone, ctx->process.in_frames, (unsigned)odone, ctx->process.max_out_frames);
+				  ctx, (unsigned)idone, ctx->process.in_frames, (unsigned)odone, space);
 	}
 
 	ctx->process.out_frames = odone;
@@ -103,12 +111,18 @@ void resample_samples(struct thread_ctx_s *ctx) {
 	}
 }
 
-bool resample_drain(struct thread_ctx_s *ctx) {
+bool resample_drain(struct thread_ctx_s *ctx, u8_t *out, frames_t space) {
 	struct soxr *r = ctx->decode.process_handle;
 	size_t odone;
 	size_t clip_cnt;
 
-	soxr_error_t error = SOXR(&gr, process, r->resampler, NULL, 0, NULL, ctx->process.outbuf, ctx->process.max_out_frames, &odone);
+	// already fully drained (drain can be resumed once outputbuf has room)
+	if (r->drained) {
+		ctx->process.out_frames = 0;
+		return true;
+	}
+
+	soxr_error_t error = SOXR(&gr, process, r->resampler, NULL, 0, NULL, out, space, &odone);
 	if (error) {
 		LOG_INFO("[%p]: soxr_process error: %s", ctx, soxr_strerror(error));
 		return true;
@@ -127,8 +141,8 @@ bool resample_drain(struct thread_ctx_s *ctx) {
 
 		LOG_INFO("[%p]: resample track complete - total track clips: %u", ctx, r->old_clips);
 
-		SOXR(&gr, delete, r->resampler);
-		r->resampler = NULL;
+		// keep resampler, it will be cleared and reused if next track has same rates
+		r->drained = true;
 
 		return true;
 
@@ -185,6 +199,20 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 	ctx->process.in_sample_rate = raw_sample_rate;
 	ctx->process.out_sample_rate = outrate;
 
+	// same rates than previous stream (spec is per player), just reset filter state
+	if (r->resampler && r->in_rate == raw_sample_rate && r->out_rate == outrate) {
+		soxr_error_t error = SOXR(&gr, clear, r->resampler);
+
+		if (!error) {
+			LOG_INFO("[%p]: resampling from %u -> %u (reused)", ctx, raw_sample_rate, outrate);
+			r->old_clips = 0;
+			r->drained = false;
+			return true;
+		}
+
+		LOG_INFO("[%p]: soxr_clear error: %s", ctx, soxr_strerror(error));
+	}
+
 	if (r->resampler) {
 		SOXR(&gr, delete, r->resampler);
 		r->resampler = NULL;
@@ -219,7 +247,7 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 		}
 
 #if RESAMPLE_MP
-		r_spec = SOXR(&gr, runtime_spec, 0); // make use of libsoxr OpenMP support allowing parallel execution if multiple cores
+		r_spec = SOXR(&gr, runtime_spec, r->threads); // make use of libsoxr OpenMP support allowing parallel execution if multiple cores
 #endif
 
 		LOG_DEBUG("[%p]: resampling with soxr_quality_spec_t[precision: %03.1f, passband_end: %03.6f, stopband_begin: %03.6f, "
@@ -234,10 +262,14 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 
 		if (error) {
 			LOG_INFO("[%p]: soxr_create error: %s", ctx, soxr_strerror(error));
+			r->resampler = NULL;
 			return false;
 		}
 
+		r->in_rate = raw_sample_rate;
+		r->out_rate = outrate;
 		r->old_clips = 0;
+		r->drained = false;
 		return true;
 
 	} else {
@@ -250,9 +282,10 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 void resample_flush(struct thread_ctx_s *ctx) {
 	struct soxr *r = ctx->decode.process_handle;
 
+	// filter is rebuilt only if next stream has different rates
 	if (r->resampler) {
-		SOXR(&gr, delete, r->resampler);
-		r->resampler = NULL;
+		SOXR(&gr, clear, r->resampler);
+		r->drained = true;
 	}
 }
 
@@ -261,6 +294,7 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 	char *recipe = NULL, *flags = NULL;
 	char *atten = NULL;
 	char *precision = NULL, *passband_end = NULL, *stopband_begin = NULL, *phase_response = NULL;
+	char *threads = NULL;
 
 #if !LINKALL
 	if (!gr.handle) return false;
@@ -273,6 +307,7 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 	}
 
 	r->resampler = NULL;
+	r->drained = false;
 	r->old_clips = 0;
 	// do not try to go max_rate
 	r->max_rate = false;
@@ -287,6 +322,7 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 		passband_end = next_param(NULL, ':');
 		stopband_begin = next_param(NULL, ':');
 		phase_response = next_param(NULL, ':');
+		threads = next_param(NULL, ':');
 	}
 
 	// default to QQ (16 bit) if not user specified
@@ -337,6 +373,19 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 		r->q_phase_response = atof(phase_response);
 	}
 
+#if RESAMPLE_MP
+	// 0 lets soxr use all cores, cap it when many players upsample at once
+	if (threads) {
+		int n = atoi(threads);
+		r->threads = n < 0 ? 0 : min(n, MAX_RESAMPLE_THREADS);
+	} else r->threads = 0;
+	LOG_INFO("[%p]: resampling threads: %u", ctx, r->threads);
+#else
+	if (threads) {
+		LOG_WARN("[%p]: resampling threads ignored (%s), not built with RESAMPLE_MP", ctx, threads);
+	}
+#endif
+
 	LOG_INFO("[%p]: resampling %s recipe: 0x%02x, flags: 0x%02x, scale: %03.2f, precision: %03.1f, passband_end: %03.5f, stopband_begin: %03.5f, phase_response: %03.1f",
 			ctx, r->max_rate ? "async" : "sync",
 			r->q_recipe, r->q_flags, r->scale, r->q_precision, r->q_passband_end, r->q_stopband_begin, r->q_phase_response);
@@ -346,7 +395,11 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 
 
 void resample_end(struct thread_ctx_s *ctx) {
-	if (ctx->decode.process_handle) free(ctx->decode.process_handle);
+	struct soxr *r = ctx->decode.process_handle;
+
+	if (!r) return;
+	if (r->resampler) SOXR(&gr, delete, r->resampler);
+	free(r);
 }
 
 
@@ -364,6 +417,7 @@ static bool load_soxr(void) {
 	gr.soxr_quality_spec = dlsym(gr.handle, "soxr_quality_spec");
 	gr.soxr_create = dlsym(gr.handle, "soxr_create");
 	gr.soxr_delete = dlsym(gr.handle, "soxr_delete");
+	gr.soxr_clear = dlsym(gr.handle, "soxr_clear");
 	gr.soxr_process = dlsym(gr.handle, "soxr_process");
 	gr.soxr_num_clips = dlsym(gr.handle, "soxr_num_clips");
 #if RESAMPLE_MP
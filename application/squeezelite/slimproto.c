@@ -1022,7 +1022,6 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 	// try to handle next track failed stream where we jump over N tracks
 	info.index = ctx->render.index != -1 ? out->index - ctx->render.index : 0;
 	info.flow = out->encode.flow;
-	_buf_resize(ctx->outputbuf, ctx->config.outputbuf_size);
 	UNLOCK_O;
 
 	/*
@@ -1072,6 +1071,9 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 
 	// in flow mode we now have eveything, just initialize codec
 	if (out->encode.flow) {
+		LOCK_O;
+		_buf_resize(ctx->outputbuf, ctx->config.outputbuf_size);
+		UNLOCK_O;
 		if (out->icy.active) output_set_icy(&info.metadata, ctx);
 		metadata_free(&info.metadata);
 		return codec_open(out->codec, out->sample_size, out->sample_rate,
@@ -1085,6 +1087,7 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 	else if (strcasestr(mode, "aac")) out->encode.mode = ENCODE_AAC;
 	else if (strcasestr(mode, "mp3")) out->encode.mode = ENCODE_MP3;
 	else if (strcasestr(mode, "null")) out->encode.mode = ENCODE_NULL;
+	else if (strcasestr(mode, "adapt")) out->encode.mode = output_adapt(ctx);
 	// auto mode will use thru only if we have a real chance for icy (arbitrary limitation of codecs here)
 	else if (info.metadata.valid && !out->duration && ctx->config.send_icy != ICY_NONE &&
 			 ((format == 'm' && mimetype_match_codec(ctx->mimetypes, 2, "mp3", "mpeg")) ||
@@ -1101,6 +1104,8 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 
 	// force re-encoding channels to be re-read
 	out->encode.channels = 0;
+	// decoder decides if pcm can be sent in its native format
+	out->encode.native = false;
 	// reset time offset for new tracks
 	out->offset = 0;
 	out->icy.interval = 16 * 1024;
@@ -1249,6 +1254,11 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 		out->out_endian = (out->format == 'w');
 		out->length = ctx->config.stream_length;				
 
+		// size outputbuf once, pcm that will likely be sent natively needs less
+		LOCK_O;
+		_buf_resize(ctx->outputbuf, pcm_outputbuf_size(ctx));
+		UNLOCK_O;
+
 		if (codec_open(out->codec, out->sample_size, out->sample_rate, out->channels,
 			out->in_endian, ctx) &&	output_start(ctx)) {
 
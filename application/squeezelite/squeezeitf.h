@@ -42,6 +42,7 @@ typedef	struct sq_dev_param_s {
 	char		codecs[STR_LEN];
 	char		mode[STR_LEN];
 	enum { HTTP_CACHE_MEMORY = 0, HTTP_CACHE_INFINITE = 1, HTTP_CACHE_DISK = 2 } cache;
+	int			pacing;			// seconds sent ahead of realtime before pacing (0 = none)
 	bool		force_aac;
 	int         next_delay;
 	char 		raw_audio_format[STR_LEN];
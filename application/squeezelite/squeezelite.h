@@ -131,6 +131,7 @@
 
 #include "squeezeitf.h"
 #include "mimetypes.h"
+#include "pcm_convert.h"
 #include "cross_log.h"
 #include "cross_net.h"
 #include "cross_util.h"
@@ -239,6 +240,24 @@ void 		packn(u16_t *dest, u16_t val);
 u32_t 		unpackN(u32_t *src);
 u16_t 		unpackn(u16_t *src);
 
+// sample size table of an mp4 track, either fixed, run-length encoded or plain
+struct mp4_run {
+	u32_t size, count;
+};
+
+struct mp4_sizes {
+	u32_t fixed, entries, index;
+	struct mp4_run *runs;
+	u32_t *sizes;
+	u32_t run, offset;
+};
+
+u32_t		mp4_box_consume(char *type, u32_t len);
+bool		mp4_sizes_init(struct mp4_sizes *s, u8_t *stsz, u32_t len);
+u32_t		mp4_sizes_peek(struct mp4_sizes *s);
+void		mp4_sizes_next(struct mp4_sizes *s);
+void		mp4_sizes_free(struct mp4_sizes *s);
+
 // buffer.c
 struct buffer {
 	u8_t *buf;
@@ -362,6 +381,8 @@ struct processstate {
 	u8_t *inbuf, *outbuf;
 	unsigned max_in_frames, max_out_frames;
 	unsigned in_frames, out_frames;
+	unsigned out_pos;
+	bool draining;
 	unsigned in_sample_rate, out_sample_rate;
 	unsigned long total_in, total_out;
 };
@@ -393,7 +414,7 @@ bool 		codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate,
 #if PROCESS
 // process.c
 void 		process_samples(struct thread_ctx_s *ctx);
-void 		process_drain(struct thread_ctx_s *ctx);
+bool 		process_drain(struct thread_ctx_s *ctx);
 void 		process_flush(struct thread_ctx_s *ctx);
 unsigned 	process_newstream(bool *direct, unsigned raw_sample_rate,
 							  int supported_rates[], struct thread_ctx_s *ctx);
@@ -404,8 +425,8 @@ void 		process_end(struct thread_ctx_s *ctx);
 #if RESAMPLE
 // resample.c
 
-void 		resample_samples(struct thread_ctx_s *ctx);
-bool 		resample_drain(struct thread_ctx_s *ctx);
+void 		resample_samples(struct thread_ctx_s *ctx, u8_t *out, frames_t space);
+bool 		resample_drain(struct thread_ctx_s *ctx, u8_t *out, frames_t space);
 bool 		resample_newstream(unsigned raw_sample_rate, int supported_rates[],
 							   struct thread_ctx_s *ctx);
 void 		resample_flush(struct thread_ctx_s *ctx);
@@ -436,11 +457,19 @@ typedef enum { ENCODE_THRU, ENCODE_NULL, ENCODE_PCM, ENCODE_FLAC, ENCODE_AAC, EN
 struct output_thread_s {
 	bool			running, lingering;
 	bool			terminate;
+	bool			active, busy;	// worker exists / worker is serving a track
 	thread_type 	thread;
+	pthread_cond_t	cond;			// signaled (with outputbuf's mutex) when busy changes
 	int				http;			// listening socket of http server
 	int 			index, slot;
+	struct thread_ctx_s *ctx;
+	// recycled from one track to the other
+	struct buffer	obuf, backlog;
+	struct cache_buffer_s *cache;
 };
 
+enum { OUTPUT_POOL_HEADER, OUTPUT_POOL_ENCODE, OUTPUT_POOL_CODEC, OUTPUT_POOL_CODEC_BUFFER, OUTPUT_POOL_MAX };
+
 // info for the track being sent to the http renderer (not played)
 struct outputstate {
 	output_state state;		// license to stream or not
@@ -454,6 +483,7 @@ struct outputstate {
 	u32_t 	duration;       // duration of track in ms, 0 if unknown
 	u32_t	offset;			// offset of track in ms (for flow mode)
 	u32_t	bitrate;	  	// as per name
+	u32_t	byte_rate;		// realtime bytes/s of what is sent, 0 if unknown (for pacing)
 	int64_t length;			// HTTP content-length (-1:no chunked, -3 chunked if possible, >=0 fake length)
 	int 	index;			// track counter (see output_thread)
 	u16_t	port;			// port of latest thread (mainy used for codc)
@@ -480,6 +510,11 @@ struct outputstate {
 		size_t size, count;
 		u8_t *buffer;
 	} header;
+	// per-track allocations, kept and recycled from one track to the other
+	struct {
+		void	*data;
+		size_t	size;
+	} pool[OUTPUT_POOL_MAX];
 	// only useful with decode mode
 	fade_state  fade; 		// fading state
 	unsigned 	fade_secs;  // set by slimproto
@@ -497,11 +532,23 @@ struct outputstate {
 		u8_t 	channels;
 		encode_mode mode;	// thru, pcm, flac, mp3, aac
 		bool  	flow;		// thread do not exit when track ends
+		bool	native;		// pcm sent as received (no gain, fade or resampling)
 		void 	*codec; 	// re-encoding codec
 		void* codec_private;	// whatever the codec does not want us to see
 		u8_t	*buffer;	// interim codec buffer (optional)
 		size_t	count;		// # of *frames* in buffer or # of silence blocks to send (null mode)
 	} encode;				// format of what being sent to player
+	struct {
+		void	*encoder;	// finished encoder kept for next track
+		int		level;		// compression level when tuned by CPU load
+		u64_t	us, frames;	// time spent encoding current track and frames encoded
+	} flac;
+	struct {
+		int		step;		// position in the adaptive ladder, -1 when not started
+		int		param;		// FLAC level or bitrate of that step
+		u32_t	capacity;	// best bytes/s the renderer took on last track, 0 if unknown
+		bool	behind;		// renderer could not keep up with realtime on last track
+	} adapt;
 };
 
 // http renderer state (track being played)
@@ -523,10 +570,13 @@ bool		output_init(void);
 void		output_end(void);
 void		output_set_icy(struct metadata_s* metadata, struct thread_ctx_s* ctx);
 void 		output_free_icy(struct thread_ctx_s *ctx);
+encode_mode	output_adapt(struct thread_ctx_s *ctx);
 
 bool		_output_lingers(struct thread_ctx_s* ctx, int index);
 void 		_output_terminate(struct thread_ctx_s* ctx, int index);
 void 		_output_terminate_below(struct thread_ctx_s* ctx, int index);
+void 		_output_wait(struct output_thread_s *thread);
+void 		_output_release(struct output_thread_s *thread);
 
 bool		_output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx);
 void 		_output_new_stream(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx);
@@ -537,6 +587,7 @@ void 		_checkduration(u32_t frames, struct thread_ctx_s *ctx);
 // output_http.c
 bool 		output_flush(struct thread_ctx_s *ctx, bool full);
 bool		output_start(struct thread_ctx_s *ctx);
+void		output_http_close(struct thread_ctx_s *ctx);
 
 /***************** main thread context**************/
 typedef struct {
@@ -558,7 +609,7 @@ typedef enum {TRACK_STOPPED = 0, TRACK_STARTED, TRACK_PAUSED} track_status_t;
 
 #define PLAYER_NAME_LEN 64
 #define SERVER_VERSION_LEN	32
-#define MAX_PLAYER		32
+#define MAX_PLAYER		1024
 
 struct thread_ctx_s {
 	int 		self;
@@ -618,7 +669,8 @@ struct thread_ctx_s {
 	u8_t 	last_command;
 };
 
-extern struct thread_ctx_s 	thread_ctx[MAX_PLAYER];
+extern struct thread_ctx_s 	*thread_ctx[MAX_PLAYER];
+extern int					thread_count;
 extern struct in_addr		sq_local_host;
 extern u16_t 				sq_local_port;
 extern char  				sq_model_name[];
@@ -635,6 +687,7 @@ struct codec*	register_m4a_thru(void);
 void		 	deregister_m4a_thru(void);
 struct codec*	register_pcm(void);
 void		 	deregister_pcm(void);
+size_t			pcm_outputbuf_size(struct thread_ctx_s *ctx);
 struct codec*	register_vorbis(void);
 void		 	deregister_vorbis(void);
 struct codec*	register_faad(void);
@@ -253,10 +253,29 @@ static u32_t inline itohl(u32_t littlelong) {
  * https://xiph.org/vorbis/doc/Vorbis_I_spec.html#x1-610004.2 */
 
 #if !USE_LIBOGG
+/* returns position after needle or n if not found, in which case offset is how many bytes of the
+ * needle were matched at the end of haystack, to be continued at next call (needles we use do not
+ * overlap with themselves so a broken partial match can just restart at the beginning) */
 static size_t memfind(const u8_t* haystack, size_t n, const char* needle, size_t len, size_t* offset) {
-	size_t i;
-	for (i = 0; i < n && *offset != len; i++) *offset = (haystack[i] == needle[*offset]) ? *offset + 1 : 0;
-	return i;
+	size_t i = 0;
+
+	// first finish a match started at the end of previous haystack
+	if (*offset) {
+		while (i < n && *offset < len && haystack[i] == (u8_t) needle[*offset]) i++, (*offset)++;
+		if (*offset == len || i == n) return i;
+		*offset = i = 0;
+	}
+
+	// memchr is usually vectorized, so only candidates are checked
+	for (const u8_t* p = haystack; (p = memchr(p, needle[0], haystack + n - p)) != NULL; p++) {
+		size_t avail = min(len, (size_t) (haystack + n - p));
+		if (!memcmp(p, needle, avail)) {
+			*offset = avail;
+			return p - haystack + avail;
+		}
+	}
+
+	return n;
 }
 
  /* this mode is made to save memory and CPU by not calling ogg decoding function and never having
@@ -339,7 +358,7 @@ static void stream_ogg(struct thread_ctx_s* ctx, size_t n) {
 			 * accross multiple pages */
 			if (ctx->stream.ogg.flac) ofs = 4;
 			else if (!memcmp(ctx->stream.ogg.data, "\x7f""FLAC", 5)) ctx->stream.ogg.flac = true;
-			else for (size_t n = 0; *tag; tag++, ofs = 0) if ((ofs = memfind(ctx->stream.ogg.data, ctx->stream.ogg.want, *tag, strlen(*tag), &n)) && n == strlen(*tag)) break;
+			else for (size_t n = 0; *tag; tag++, ofs = n = 0) if ((ofs = memfind(ctx->stream.ogg.data, ctx->stream.ogg.want, *tag, strlen(*tag), &n)) && n == strlen(*tag)) break;
 
 			if (ofs) {
 				// u32:len,char[]:vendorId, u32:N, N x (u32:len,char[]:comment)
@@ -165,3 +165,88 @@ u16_t unpackn(u16_t* src) {
 
 	 return ret && ret[0] ? ret : NULL;
  }
+
+/*---------------------------------------------------------------------------*/
+/* MP4 helpers shared by the mp4 parsers of alac, faad and m4a_thru. The stsz
+ * sample size table is stored as runs when that is smaller than a plain
+ * table, which is the case for most CBR-ish AAC and for ALAC silence		 */
+/*---------------------------------------------------------------------------*/
+u32_t mp4_box_consume(char *type, u32_t len) {
+	// read into these boxes so reduce consume
+	if (!strcmp(type, "moov") || !strcmp(type, "trak") || !strcmp(type, "mdia") || !strcmp(type, "minf") || !strcmp(type, "stbl") ||
+		!strcmp(type, "udta") || !strcmp(type, "ilst")) {
+		return 8;
+	}
+	// special cases which mix mix data in the enclosing box which we want to read into
+	if (!strcmp(type, "stsd")) return 16;
+	if (!strcmp(type, "mp4a")) return 36;
+	if (!strcmp(type, "meta")) return 12;
+
+	// default to consuming entire box
+	return len;
+}
+
+bool mp4_sizes_init(struct mp4_sizes *s, u8_t *stsz, u32_t len) {
+	u8_t *ptr = stsz + 20;
+	u32_t i, runs = 0, last = 0;
+
+	mp4_sizes_free(s);
+	if (len < 20) return false;
+	s->fixed = unpackN((u32_t*) (stsz + 12));
+	s->entries = unpackN((u32_t*) (stsz + 16));
+	if (s->fixed || !s->entries) return true;
+	s->entries = min(s->entries, (len - 20) / 4);
+
+	// count runs first to choose the smallest representation
+	for (i = 0; i < s->entries; i++, ptr += 4) {
+		u32_t size = unpackN((u32_t*) ptr);
+		if (!i || size != last) runs++;
+		last = size;
+	}
+
+	ptr = stsz + 20;
+
+	if (runs * sizeof(struct mp4_run) < s->entries * sizeof(u32_t)) {
+		struct mp4_run *run;
+		if ((s->runs = malloc(runs * sizeof(struct mp4_run))) == NULL) return false;
+		run = s->runs;
+		run->size = unpackN((u32_t*) ptr);
+		run->count = 0;
+		for (i = 0; i < s->entries; i++, ptr += 4) {
+			u32_t size = unpackN((u32_t*) ptr);
+			if (size != run->size) {
+				run++;
+				run->size = size;
+				run->count = 0;
+			}
+			run->count++;
+		}
+	} else {
+		if ((s->sizes = malloc(s->entries * sizeof(u32_t))) == NULL) return false;
+		for (i = 0; i < s->entries; i++, ptr += 4) s->sizes[i] = unpackN((u32_t*) ptr);
+	}
+
+	return true;
+}
+
+u32_t mp4_sizes_peek(struct mp4_sizes *s) {
+	if (s->index >= s->entries) return 0;
+	if (s->runs) return s->runs[s->run].size;
+	if (s->sizes) return s->sizes[s->index];
+	return s->fixed;
+}
+
+void mp4_sizes_next(struct mp4_sizes *s) {
+	if (s->index >= s->entries) return;
+	s->index++;
+	if (s->runs && ++s->offset == s->runs[s->run].count) {
+		s->run++;
+		s->offset = 0;
+	}
+}
+
+void mp4_sizes_free(struct mp4_sizes *s) {
+	if (s->runs) free(s->runs);
+	if (s->sizes) free(s->sizes);
+	memset(s, 0, sizeof(struct mp4_sizes));
+}
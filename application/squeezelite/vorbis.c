@@ -360,14 +360,6 @@ static inline int32_t clip15(int32_t x) {
 	ret -= ((x >= -32768) - 1) & (x + 32768);
 	return ret;
 }
-
-static inline int32_t clip15f(float x) {
-	int32_t ret = x * (1 << (DEPTH-1)) + 0.5f;
-	if (ret > (1 << (DEPTH-1)) - 1) ret = (1 << (DEPTH-1)) - 1;
-	else if (ret < -(1 << (DEPTH-1))) ret = -(1 << (DEPTH-1));
-	return ret;
-
-}
 #endif
 
 static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
@@ -501,22 +493,8 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 			frames_t count = frames;
 			s32_t* optr = (s32_t*)write_buf;
 
-			if (v->channels == 2) {
-				float* iptr_l = pcm[0];
-				float* iptr_r = pcm[1];
-
-				while (count--) {
-					*optr++ = clip15f(*iptr_l++) << (32 - DEPTH);
-					*optr++ = clip15f(*iptr_r++) << (32 - DEPTH);
-				}
-			}
-			else if (v->channels == 1) {
-				float* iptr = pcm[0];
-				while (count--) {
-					*optr++ = clip15f(*iptr) << (32 - DEPTH);
-					*optr++ = clip15f(*iptr++) << (32 - DEPTH);
-				}
-			}
+			if (v->channels == 2) pcm_from_float(optr, pcm[0], pcm[1], count, DEPTH);
+			else if (v->channels == 1) pcm_from_float(optr, pcm[0], pcm[0], count, DEPTH);
 		}
 #if !LINKALL
 		else 